@@ -0,0 +1,532 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "comb_parser.h"
+#include "charset.h"
+#include "scan.h"
+#include "trie.h"
+
+// Reified grammars.
+//
+// ast::expr builds grammar as a tree of nodes instead of opaque std::function closures,
+// with the same operators as parser has. Tree may be inspected, optimized and then compiled
+// into ordinary parser<Char, Iter, Args...>:
+//
+//   using g = ast::expr<char, Iter, uri_info*>;
+//   const g schema = g{"http"} | g{"https"} | g{"ftp"};
+//   const auto schema_parser = schema.optimize().compile();
+//
+// Optimizer pass:
+//   - flattens nested sequences and choices,
+//   - fuses adjacent chars and literals of sequence into one literal (compared with memcmp over contiguous bytes),
+//   - computes FIRST charsets of choice alternatives, so compiled choice dispatches through
+//     256-entry table on lookahead byte and tries only alternatives which may match,
+//   - merges literal alternatives of longest(...) into trie, so they are matched in one pass.
+
+namespace comb_parser::ast {
+
+enum class kind {
+  end,        // end of input
+  chr,        // single char
+  literal,    // string
+  set,        // one or more chars from charset
+  sequence,   // a + b + ...
+  choice,     // a | b | ...
+  longest,    // longest(a, b, ...)
+  optional,   // ~a
+  repeat,     // repeat(a, from, to)
+  skip,       // a >> b
+  check_next, // a << b
+  negation,   // !a
+  process,    // a % b
+  action,     // a % action
+  ref         // opaque parser
+};
+
+template<typename Char = char, typename Iter = const char*, typename ...Args>
+class expr {
+public:
+  using parser_type = parser<Char, Iter, Args...>;
+  using action_fn = typename parser_type::parserFn;
+
+  struct node;
+  using node_ptr = std::shared_ptr<const node>;
+
+  // FIRST set of node: chars which may start a match, and whether it may match empty input
+  struct first_info {
+    charset::charset first;
+    bool nullable;
+  };
+
+  struct node {
+    ast::kind kind;
+    std::basic_string<Char> text;   // chr, literal
+    charset::charset set;           // set
+    std::vector<node_ptr> children;
+    int from_times = 0;             // repeat
+    int to_times = -1;
+    action_fn fn;                   // action
+    parser_type ref;                // ref
+    std::vector<first_info> alternatives; // choice, longest, filled by optimizer
+    std::shared_ptr<const literal_trie<Char>> trie; // longest: literal alternatives, filled by optimizer
+    std::vector<int> order;         // longest: positions of children and trie literals among alternatives
+  };
+
+  expr(Char c) : root(make(kind::chr)) { mut().text.assign(1, c); }
+  expr(const Char* arr) : root(make(kind::literal)) { mut().text = arr; }
+  expr(const charset::charset& cs) : root(make(kind::set)) { mut().set = cs; }
+  expr(const charset::static_charset& cs) : expr(charset::charset{cs}) { }
+  expr(const parser_type& p) : root(make(kind::ref)) { mut().ref = p; }
+  explicit expr(node_ptr n) : root(std::move(n)) { }
+
+  static expr end() { return expr{make(kind::end)}; }
+
+  const node& get() const { return *root; }
+  const node_ptr& ptr() const { return root; }
+
+  static expr make_node(ast::kind k, std::vector<node_ptr> children) {
+    auto n = std::make_shared<node>();
+    n->kind = k;
+    n->children = std::move(children);
+    return expr{std::move(n)};
+  }
+
+  static expr make_repeat(const expr& e, int from_times, int to_times) {
+    auto n = std::make_shared<node>();
+    n->kind = kind::repeat;
+    n->children = {e.root};
+    n->from_times = from_times;
+    n->to_times = to_times;
+    return expr{std::move(n)};
+  }
+
+  static expr make_action(const expr& e, action_fn fn) {
+    auto n = std::make_shared<node>();
+    n->kind = kind::action;
+    n->children = {e.root};
+    n->fn = std::move(fn);
+    return expr{std::move(n)};
+  }
+
+  //=====================
+  // Analysis
+
+  static first_info first_of(const node& n) {
+    switch (n.kind) {
+      case kind::end:
+      case kind::negation:
+        return {charset::charset{}, true};
+      case kind::chr:
+        return {charset::charset{std::string(1, static_cast<char>(n.text[0]))}, false};
+      case kind::literal:
+        if (n.text.empty()) return {charset::charset{}, true};
+        return {charset::charset{std::string(1, static_cast<char>(n.text[0]))}, false};
+      case kind::set:
+        return {n.set, false};
+      case kind::sequence:
+      case kind::skip:
+      case kind::check_next: {
+        first_info fi{charset::charset{}, true};
+        for (auto& c: n.children) {
+          auto ci = first_of(*c);
+          fi.first = fi.first + ci.first;
+          if (!ci.nullable) { fi.nullable = false; break; }
+        }
+        return fi;
+      }
+      case kind::choice:
+      case kind::longest: {
+        first_info fi{charset::charset{}, false};
+        for (auto& c: n.children) {
+          auto ci = first_of(*c);
+          fi.first = fi.first + ci.first;
+          fi.nullable = fi.nullable || ci.nullable;
+        }
+        for (std::size_t i = 0; n.trie && i < n.trie->size(); ++i) {
+          auto& l = n.trie->literal(i);
+          if (l.empty()) fi.nullable = true;
+          else fi.first = fi.first + charset::charset{std::string(1, static_cast<char>(l[0]))};
+        }
+        return fi;
+      }
+      case kind::optional:
+        return {first_of(*n.children[0]).first, true};
+      case kind::repeat: {
+        auto ci = first_of(*n.children[0]);
+        return {ci.first, ci.nullable || n.from_times == 0};
+      }
+      case kind::process:
+      case kind::action:
+        return first_of(*n.children[0]);
+      case kind::ref:
+        break;
+    }
+    return {!charset::charset{}, true}; // unknown
+  }
+
+  // textual form of tree, for debugging
+  std::string dump() const { return dump(*root); }
+
+  //=====================
+  // Optimizer pass
+
+  expr optimize() const { return expr{optimize(root)}; }
+
+  //=====================
+  // Compilation to parser
+
+  parser_type compile() const { return compile(*root); }
+
+private:
+  node_ptr root;
+
+  static std::shared_ptr<node> make(ast::kind k) {
+    auto n = std::make_shared<node>();
+    n->kind = k;
+    return n;
+  }
+
+  node& mut() { return const_cast<node&>(*root); }
+
+  static std::string dump(const node& n) {
+    auto list = [&](const char* sep) {
+      std::string s = "(";
+      for (std::size_t i = 0; i < n.children.size(); ++i) {
+        if (i) s += sep;
+        s += dump(*n.children[i]);
+      }
+      return s + ")";
+    };
+    switch (n.kind) {
+      case kind::end: return "end";
+      case kind::chr: return "'" + std::string(n.text.begin(), n.text.end()) + "'";
+      case kind::literal: return "\"" + std::string(n.text.begin(), n.text.end()) + "\"";
+      case kind::set: return "[set]";
+      case kind::sequence: return list(" + ");
+      case kind::choice: return list(" | ");
+      case kind::longest: {
+        std::string s = "longest(";
+        for (std::size_t i = 0; i < n.children.size(); ++i) s += (i ? ", " : "") + dump(*n.children[i]);
+        if (n.trie) s += std::string(n.children.empty() ? "" : ", ") + "trie[" + std::to_string(n.trie->size()) + "]";
+        return s + ")";
+      }
+      case kind::optional: return "~" + dump(*n.children[0]);
+      case kind::repeat:
+        return "repeat(" + dump(*n.children[0]) + ", " + std::to_string(n.from_times) + ", " + std::to_string(n.to_times) + ")";
+      case kind::skip: return list(" >> ");
+      case kind::check_next: return list(" << ");
+      case kind::negation: return "!" + dump(*n.children[0]);
+      case kind::process: return list(" % ");
+      case kind::action: return "(" + dump(*n.children[0]) + " % action)";
+      case kind::ref: return "parser";
+    }
+    return "?";
+  }
+
+  static bool is_text(const node& n) { return n.kind == kind::chr || n.kind == kind::literal; }
+
+  // alternatives of longest in original order, nested longests are expanded
+  static void longest_alternatives(const node& n, std::vector<node_ptr>& out) {
+    std::vector<std::pair<int, node_ptr>> alts;
+    for (std::size_t i = 0; i < n.children.size(); ++i) {
+      alts.emplace_back(n.order.empty() ? static_cast<int>(i) : n.order[i], n.children[i]);
+    }
+    for (std::size_t i = 0; n.trie && i < n.trie->size(); ++i) {
+      auto lit = make(kind::literal);
+      lit->text = n.trie->literal(i);
+      alts.emplace_back(n.order[n.children.size() + i], lit);
+    }
+    std::stable_sort(alts.begin(), alts.end(), [](auto& a, auto& b){ return a.first < b.first; });
+    for (auto& a: alts) {
+      if (a.second->kind == kind::longest) longest_alternatives(*a.second, out);
+      else out.push_back(a.second);
+    }
+  }
+
+  static node_ptr optimize_longest(const node& n) {
+    std::vector<node_ptr> alts;
+    longest_alternatives(n, alts);
+    auto copy = make(kind::longest);
+    std::vector<std::basic_string<Char>> literals;
+    std::vector<int> literal_order;
+    for (std::size_t i = 0; i < alts.size(); ++i) {
+      auto a = optimize(alts[i]);
+      if (is_text(*a)) {
+        literals.push_back(a->text);
+        literal_order.push_back(static_cast<int>(i));
+      } else {
+        copy->children.push_back(a);
+        copy->order.push_back(static_cast<int>(i));
+        copy->alternatives.push_back(first_of(*a));
+      }
+    }
+    if (literals.size() == 1 && alts.size() == 1) {
+      auto lit = make(kind::literal);
+      lit->text = literals[0];
+      return lit;
+    }
+    if (!literals.empty()) {
+      copy->trie = std::make_shared<literal_trie<Char>>(literals);
+      copy->order.insert(copy->order.end(), literal_order.begin(), literal_order.end());
+    }
+    return copy;
+  }
+
+  static node_ptr optimize(const node_ptr& n) {
+    if (n->kind == kind::longest) return optimize_longest(*n);
+    auto copy = std::make_shared<node>(*n);
+    for (auto& c: copy->children) c = optimize(c);
+
+    if (copy->kind == kind::sequence || copy->kind == kind::choice) {
+      // flatten
+      std::vector<node_ptr> flat;
+      for (auto& c: copy->children) {
+        if (c->kind == copy->kind) flat.insert(flat.end(), c->children.begin(), c->children.end());
+        else flat.push_back(c);
+      }
+      // fuse adjacent chars and literals
+      if (copy->kind == kind::sequence) {
+        std::vector<node_ptr> fused;
+        for (auto& c: flat) {
+          if (!fused.empty() && is_text(*fused.back()) && is_text(*c)) {
+            auto lit = std::make_shared<node>(*fused.back());
+            lit->kind = kind::literal;
+            lit->text += c->text;
+            fused.back() = lit;
+          } else {
+            fused.push_back(c);
+          }
+        }
+        flat = std::move(fused);
+      }
+      if (flat.size() == 1) return flat[0];
+      copy->children = std::move(flat);
+      if (copy->kind == kind::choice) {
+        copy->alternatives.clear();
+        for (auto& c: copy->children) copy->alternatives.push_back(first_of(*c));
+      }
+    }
+    return copy;
+  }
+
+  static parser_type compile(const node& n) {
+    switch (n.kind) {
+      case kind::end: return parser_type::end();
+      case kind::chr: return parser_type{n.text[0]};
+      case kind::literal: return compile_literal(n.text);
+      case kind::set: return parser_type{n.set};
+      case kind::sequence: return compile_sequence(n);
+      case kind::choice: return n.alternatives.empty() ? compile_choice(n) : compile_dispatch(n);
+      case kind::longest: return compile_longest(n);
+      case kind::optional: return ~compile(*n.children[0]);
+      case kind::repeat: return repeat(compile(*n.children[0]), n.from_times, n.to_times);
+      case kind::skip: return compile_binary(n, [](auto a, auto b){ return a >> b; });
+      case kind::check_next: return compile_binary(n, [](auto a, auto b){ return a << b; });
+      case kind::negation: return !compile(*n.children[0]);
+      case kind::process: return compile_binary(n, [](auto a, auto b){ return a % b; });
+      case kind::action: return compile(*n.children[0]) % n.fn;
+      case kind::ref: return n.ref;
+    }
+    return parser_type{};
+  }
+
+  // left fold of children
+  template<typename F>
+  static parser_type compile_binary(const node& n, F combine, std::size_t count = 0) {
+    if (count == 0) count = n.children.size();
+    if (count == 1) return compile(*n.children[0]);
+    return combine(compile_binary(n, combine, count - 1), compile(*n.children[count - 1]));
+  }
+
+  static parser_type compile_literal(const std::basic_string<Char>& text) {
+    return parser_type{[text](Iter& pos, Iter end, Args...)->result{
+      if (scan::match_literal(text, pos, end)) return success;
+      detail::expected_literal(pos, end, text);
+      return fail;
+    }};
+  }
+
+  static std::vector<parser_type> compile_children(const node& n) {
+    std::vector<parser_type> ps;
+    for (auto& c: n.children) ps.push_back(compile(*c));
+    return ps;
+  }
+
+  // n-ary sequence collects effects into one closure, children without effects are not stored
+  static parser_type compile_sequence(const node& n) {
+    return parser_type{[ps = compile_children(n)](Iter& pos, Iter end, Args...args)->result{
+      auto start = pos;
+      std::vector<result> results;
+      for (auto& p: ps) {
+        auto r = p(pos, end, args...);
+        if (!r) { detail::backtracked(start, pos); pos = start; return fail; }
+        if (!detail::is_success(r)) results.push_back(std::move(r));
+      }
+      return detail::joined(std::move(results));
+    }};
+  }
+
+  // cut made by '>' inside of alternative (opaque parser) commits the choice, as with operator|
+  static parser_type compile_choice(const node& n) {
+    return parser_type{[ps = compile_children(n)](Iter& pos, Iter end, Args...args)->result{
+      return try_all(ps, pos, end, args...);
+    }};
+  }
+
+  // choice with jump table on lookahead byte: slot[byte] (slot[256] is end of input)
+  // selects list of alternatives which may match
+  static parser_type compile_dispatch(const node& n) {
+    struct table {
+      std::array<uint16_t, 257> slot;
+      std::vector<std::vector<uint16_t>> lists;
+      std::array<uint64_t, 4> expected;   // FIRST chars of all alternatives, for diagnostics
+    };
+    auto t = std::make_shared<table>();
+    charset::charset firsts;
+    for (auto& a: n.alternatives) firsts = firsts + a.first;
+    t->expected = firsts.bits();
+    for (int b = 0; b <= 256; ++b) {
+      std::vector<uint16_t> list;
+      for (std::size_t i = 0; i < n.alternatives.size(); ++i) {
+        auto& a = n.alternatives[i];
+        if (a.nullable || (b < 256 && a.first(static_cast<uint8_t>(b)))) list.push_back(static_cast<uint16_t>(i));
+      }
+      auto it = std::find(t->lists.begin(), t->lists.end(), list);
+      t->slot[b] = static_cast<uint16_t>(it - t->lists.begin());
+      if (it == t->lists.end()) t->lists.push_back(std::move(list));
+    }
+    return parser_type{[ps = compile_children(n), t](Iter& pos, Iter end, Args...args)->result{
+      std::size_t b = 256;
+      if (pos != end) {
+        auto c = static_cast<std::make_unsigned_t<Char>>(*pos);
+        if (c >= 256) return try_all(ps, pos, end, args...);
+        b = c;
+      }
+      for (auto i: t->lists[t->slot[b]]) {
+        auto r = ps[i](pos, end, args...);
+        if (r) return r;
+        if (detail::cuts().cut) return fail;
+      }
+      // skipped alternatives expected their FIRST chars here
+      detail::expected_set(pos, t->expected);
+      return fail;
+    }};
+  }
+
+  // longest match: literal alternatives are matched by trie in one pass, other alternatives
+  // are tried if their FIRST set allows; of equally long matches the first alternative wins.
+  // As in longest(...), cuts do not leave alternatives
+  static parser_type compile_longest(const node& n) {
+    return parser_type{[ps = compile_children(n), trie = n.trie, order = n.order, alts = n.alternatives]
+                       (Iter& pos, Iter end, Args...args)->result{
+      auto start = pos;
+      auto best_pos = start;
+      typename std::iterator_traits<Iter>::difference_type best_length = 0;
+      int best_order = -1;
+      result best;
+      auto& cuts = detail::cuts();
+      const bool cut = cuts.cut;
+      auto offer = [&](Iter at, int ord, result r) {
+        auto length = std::distance(start, at);
+        if (!best || length > best_length || (length == best_length && ord < best_order)) {
+          best = std::move(r);
+          best_pos = at;
+          best_length = length;
+          best_order = ord;
+        }
+      };
+      if (trie) {
+        auto at = start;
+        auto idx = trie->match(at, end);
+        if (idx >= 0) offer(at, order[ps.size() + idx], success);
+        else detail::expected_set(start, trie->first_chars());
+      }
+      for (std::size_t i = 0; i < ps.size(); ++i) {
+        if (!alts.empty() && !alts[i].nullable) {
+          if (start == end) { detail::expected_set(start, alts[i].first.bits()); continue; }
+          auto c = static_cast<std::make_unsigned_t<Char>>(*start);
+          if (c < 256 && !alts[i].first(static_cast<uint8_t>(c))) { detail::expected_set(start, alts[i].first.bits()); continue; }
+        }
+        auto at = start;
+        cuts.cut = false;
+        auto r = ps[i](at, end, args...);
+        cuts.cut = false;
+        if (r) offer(at, order.empty() ? static_cast<int>(i) : order[i], std::move(r));
+      }
+      cuts.cut = cut;
+      if (best) pos = best_pos;
+      return best;
+    }};
+  }
+
+  // alternatives in order, chars out of byte range are not in jump table
+  static result try_all(const std::vector<parser_type>& ps, Iter& pos, Iter end, Args...args) {
+    for (auto& p: ps) {
+      auto r = p(pos, end, args...);
+      if (r) return r;
+      if (detail::cuts().cut) return fail;
+    }
+    return fail;
+  }
+};
+
+//====================================
+// Operators, same as for parsers
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator+(const expr<Char, Iter, Args...>& a, const expr<Char, Iter, Args...>& b) {
+  return expr<Char, Iter, Args...>::make_node(kind::sequence, {a.ptr(), b.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator|(const expr<Char, Iter, Args...>& a, const expr<Char, Iter, Args...>& b) {
+  return expr<Char, Iter, Args...>::make_node(kind::choice, {a.ptr(), b.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator>>(const expr<Char, Iter, Args...>& a, const expr<Char, Iter, Args...>& b) {
+  return expr<Char, Iter, Args...>::make_node(kind::skip, {a.ptr(), b.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator<<(const expr<Char, Iter, Args...>& a, const expr<Char, Iter, Args...>& b) {
+  return expr<Char, Iter, Args...>::make_node(kind::check_next, {a.ptr(), b.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator%(const expr<Char, Iter, Args...>& a, const expr<Char, Iter, Args...>& b) {
+  return expr<Char, Iter, Args...>::make_node(kind::process, {a.ptr(), b.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator%(const expr<Char, Iter, Args...>& a, typename expr<Char, Iter, Args...>::action_fn fn) {
+  return expr<Char, Iter, Args...>::make_action(a, std::move(fn));
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator~(const expr<Char, Iter, Args...>& a) {
+  return expr<Char, Iter, Args...>::make_node(kind::optional, {a.ptr()});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> operator!(const expr<Char, Iter, Args...>& a) {
+  return expr<Char, Iter, Args...>::make_node(kind::negation, {a.ptr()});
+}
+
+// longest(a, b, ...): longest match of alternatives
+template<typename Char, typename Iter, typename...Args, typename...Es>
+expr<Char, Iter, Args...> longest(const expr<Char, Iter, Args...>& a, const Es&... es) {
+  return expr<Char, Iter, Args...>::make_node(kind::longest, {a.ptr(), expr<Char, Iter, Args...>{es}.ptr()...});
+}
+
+template<typename Char, typename Iter, typename...Args>
+expr<Char, Iter, Args...> repeat(const expr<Char, Iter, Args...>& a, int from_times=0, int to_times=-1) {
+  return expr<Char, Iter, Args...>::make_repeat(a, from_times, to_times);
+}
+
+} // namespace comb_parser::ast
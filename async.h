@@ -0,0 +1,196 @@
+#pragma once
+
+// Asynchronous parsing with C++20 coroutines over non-blocking byte sources.
+//
+// async_parser feeds stream_parser (stream.h) from async source and suspends, when source has no
+// bytes yet, so one thread may keep many parses in flight:
+//
+//   cp::io_loop loop;
+//   cp::fd_source src{fd, loop};              // non-blocking socket or pipe
+//   cp::async_parser ap{grammar};
+//   auto t = ap.parse(src);                    // or co_await ap.parse(src) in other coroutine
+//   t.start();
+//   loop.run();                                // resumes parses, whose sockets became readable
+//   t.result();                                // stream_status
+//
+// Source is anything with read(char* buf, size_t n), awaiting of which gives number of bytes read,
+// 0 at end of input. io_loop is single-threaded and nothing here distributes sources between
+// threads: to use several threads run one io_loop per thread and give each source to one of them.
+// Available only when compiler supports coroutines (-std=c++20).
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "stream.h"
+
+namespace comb_parser {
+
+// lazy coroutine with result, starts when it is awaited (or started), resumes awaiter when done
+template<typename T>
+class task {
+public:
+  struct promise_type {
+    std::optional<T> value;
+    std::exception_ptr error;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    task get_return_object() { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        return h.promise().continuation;
+      }
+      void await_resume() noexcept { }
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  task(task&& t) noexcept : h(std::exchange(t.h, {})) { }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() { if (h) h.destroy(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    h.promise().continuation = awaiter;
+    return h;
+  }
+  T await_resume() { return result(); }
+
+  // runs top-level task until its first suspension
+  void start() { h.resume(); }
+  bool done() const { return h.done(); }
+
+  T result() {
+    if (h.promise().error) std::rethrow_exception(h.promise().error);
+    return std::move(*h.promise().value);
+  }
+
+private:
+  std::coroutine_handle<promise_type> h;
+
+  explicit task(std::coroutine_handle<promise_type> h) : h(h) { }
+};
+
+// poll-based loop: coroutines wait for readability of descriptors
+class io_loop {
+public:
+  io_loop() = default;
+  io_loop(const io_loop&) = delete;
+  io_loop& operator=(const io_loop&) = delete;
+
+  // co_await loop.readable(fd) suspends until fd is readable (or closed, or failed)
+  auto readable(int fd) {
+    struct awaiter {
+      io_loop& loop;
+      int fd;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { loop.waiting.push_back({fd, h}); }
+      void await_resume() const noexcept { }
+    };
+    return awaiter{*this, fd};
+  }
+
+  // waits up to timeout_ms (-1: forever) and resumes ready coroutines, returns their number
+  std::size_t poll_once(int timeout_ms = -1) {
+    if (waiting.empty()) return 0;
+    fds.clear();
+    for (auto& w: waiting) fds.push_back({w.fd, POLLIN, 0});
+    int n = ::poll(fds.data(), fds.size(), timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR) return 0;
+      throw std::system_error(errno, std::generic_category(), "poll");
+    }
+    // ready coroutines are taken out first, resumed ones may wait again
+    ready.clear();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < waiting.size(); ++i) {
+      if (fds[i].revents) ready.push_back(waiting[i].h);
+      else waiting[kept++] = waiting[i];
+    }
+    waiting.resize(kept);
+    for (auto h: ready) h.resume();
+    return ready.size();
+  }
+
+  // resumes coroutines until none of them waits
+  void run() {
+    while (!waiting.empty()) poll_once();
+  }
+
+  std::size_t pending() const { return waiting.size(); }
+
+private:
+  struct waiter {
+    int fd;
+    std::coroutine_handle<> h;
+  };
+  std::vector<waiter> waiting;
+  std::vector<pollfd> fds;
+  std::vector<std::coroutine_handle<>> ready;
+};
+
+// non-blocking descriptor (socket, pipe) as async source
+class fd_source {
+public:
+  fd_source(int fd, io_loop& loop) : fd(fd), loop(loop) { }
+
+  task<std::size_t> read(char* buf, std::size_t n) {
+    for (;;) {
+      auto r = ::read(fd, buf, n);
+      if (r >= 0) co_return static_cast<std::size_t>(r);
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) throw std::system_error(errno, std::generic_category(), "read");
+      co_await loop.readable(fd);
+    }
+  }
+
+private:
+  int fd;
+  io_loop& loop;
+};
+
+// stream_parser fed from async source, parser should outlive its parse tasks
+template<typename Grammar, typename ...Args>
+class async_parser {
+public:
+  explicit async_parser(Grammar g, Args...args) : sp(std::move(g), args...) { }
+
+  // reads source until grammar is decided: done, fail (need_more never)
+  template<typename Source>
+  task<stream_status> parse(Source& src) {
+    char buf[chunk_size];
+    for (;;) {
+      std::size_t n = co_await src.read(buf, sizeof(buf));
+      auto status = n == 0 ? sp.finish() : sp.feed(buf, n);
+      if (status != stream_status::need_more) co_return status;
+    }
+  }
+
+  const stream_parser<Grammar, Args...>& stream() const { return sp; }
+
+private:
+  static constexpr std::size_t chunk_size = 4096;
+  stream_parser<Grammar, Args...> sp;
+};
+
+template<typename Grammar, typename ...Args>
+async_parser(Grammar, Args...) -> async_parser<Grammar, Args...>;
+
+} // namespace comb_parser
+
+#endif
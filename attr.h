@@ -0,0 +1,447 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "comb_parser.h"
+
+// Typed attributes: parsers, which build values of known types instead of effect closures.
+//
+// Converters and actions (% on dynamic parsers) make std::function for every converted item and
+// for every action, values reach user structures through context pointers when effects are applied.
+// Typed parsers write their results straight into attribute, type of which is known at compile time:
+//   a + b        - std::tuple of attributes of a and b, nested tuples are flattened, 'unused' dropped,
+//                  tuple of one element is that element
+//   a | b        - std::variant of attributes, same types are merged, variant of one type is that type
+//   repeat(a)    - std::vector of attributes, elements are parsed in place
+//   ~a           - std::optional of attribute
+//   a % f        - f(attribute of a)
+//   into<S>(a, &S::x, &S::y) - elements of attribute of a are moved into fields of S
+// Leaves are chars, literals and dynamic parsers, which only recognize input:
+//   ch{':'}, lit{"://"}, match(p) - no attribute ('unused')
+//   text(p), view(p)              - matched chunk as std::basic_string / std::basic_string_view
+//   number<T>(p)                  - matched chunk converted with std::from_chars
+//   as<T>(p, conv)                - conv(pos, end, T& out) -> bool
+// Effects of dynamic parsers in leaves are not applied, they are only recognizers here.
+//
+//   struct endpoint { std::string host; int port; };
+//   const auto ep = attr::into<endpoint>(text(p{alpha}) + ch{':'} + number<int>(p{digit}),
+//                                        &endpoint::host, &endpoint::port);
+//   endpoint e;
+//   attr::parse(ep, pos, end, e);
+
+namespace comb_parser::attr {
+
+// attribute of parsers, which only recognize input
+struct unused { };
+
+template<typename P>
+class base {
+public:
+  const P& self() const { return static_cast<const P&>(*this); }
+};
+
+namespace detail {
+
+template<typename T> struct is_tuple : std::false_type { };
+template<typename ...Ts> struct is_tuple<std::tuple<Ts...>> : std::true_type { };
+
+template<typename T> struct is_variant : std::false_type { };
+template<typename ...Ts> struct is_variant<std::variant<Ts...>> : std::true_type { };
+
+//==========
+// sequence attributes
+
+template<typename T>
+auto as_tuple(T&& v) {
+  using D = std::decay_t<T>;
+  if constexpr (std::is_same_v<D, unused>) return std::tuple<>{};
+  else if constexpr (is_tuple<D>::value) return D{std::forward<T>(v)};
+  else return std::tuple<D>{std::forward<T>(v)};
+}
+
+template<typename Tuple> struct from_tuple { using type = Tuple; };
+template<> struct from_tuple<std::tuple<>> { using type = unused; };
+template<typename T> struct from_tuple<std::tuple<T>> { using type = T; };
+
+template<typename A, typename B>
+using seq_attribute = typename from_tuple<decltype(std::tuple_cat(as_tuple(std::declval<A>()), as_tuple(std::declval<B>())))>::type;
+
+template<typename Out, typename Tuple>
+void assign_tuple(Out& out, Tuple&& t) {
+  if constexpr (std::is_same_v<Out, unused>) (void)t;
+  else if constexpr (std::tuple_size_v<std::decay_t<Tuple>> == 1) out = std::move(std::get<0>(t));
+  else out = std::move(t);
+}
+
+//==========
+// alternative attributes
+
+template<typename ...Ts> struct types { };
+
+template<typename List, typename T>
+struct add_type;
+
+template<typename ...Us, typename T>
+struct add_type<types<Us...>, T> {
+  using type = std::conditional_t<(std::is_same_v<T, Us> || ...), types<Us...>, types<Us..., T>>;
+};
+
+template<typename List, typename ...Ts> struct add_types { using type = List; };
+
+template<typename List, typename T, typename ...Ts>
+struct add_types<List, T, Ts...> : add_types<typename add_type<List, T>::type, Ts...> { };
+
+// alternatives of variant are added one by one
+template<typename List, typename ...Vs, typename ...Ts>
+struct add_types<List, std::variant<Vs...>, Ts...> : add_types<typename add_types<List, Vs...>::type, Ts...> { };
+
+template<typename List> struct to_variant;
+template<typename T> struct to_variant<types<T>> { using type = T; };
+template<typename T, typename U, typename ...Us> struct to_variant<types<T, U, Us...>> { using type = std::variant<T, U, Us...>; };
+
+template<typename A, typename B>
+using alt_attribute = typename to_variant<typename add_types<types<>, A, B>::type>::type;
+
+template<typename Out, typename In>
+void assign_alt(Out& out, In&& in) {
+  using D = std::decay_t<In>;
+  if constexpr (std::is_same_v<Out, D>) out = std::forward<In>(in);
+  else if constexpr (is_variant<D>::value) {
+    std::visit([&out](auto&& v){ assign_alt(out, std::forward<decltype(v)>(v)); }, std::forward<In>(in));
+  } else {
+    out.template emplace<D>(std::forward<In>(in));
+  }
+}
+
+//==========
+// leaf conversions
+
+struct no_conv {
+  template<typename Iter>
+  bool operator()(Iter, Iter, unused&) const { return true; }
+};
+
+struct text_conv {
+  template<typename Iter, typename String>
+  bool operator()(Iter pos, Iter end, String& out) const { out.assign(pos, end); return true; }
+};
+
+struct view_conv {
+  template<typename Iter, typename View>
+  bool operator()(Iter pos, Iter end, View& out) const {
+    out = View{reinterpret_cast<const typename View::value_type*>(comb_parser::detail::data_of(pos, end)),
+               static_cast<std::size_t>(end - pos)};
+    return true;
+  }
+};
+
+struct number_conv {
+  template<typename Iter, typename T>
+  bool operator()(Iter pos, Iter end, T& out) const { return comb_parser::detail::from_chars(pos, end, out); }
+};
+
+} // namespace detail
+
+//==========
+// Leaf parsers
+
+// single char
+template<typename Char>
+class ch : public base<ch<Char>> {
+  Char c;
+public:
+  using attribute = unused;
+
+  constexpr ch(Char c) : c(c) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, unused&) const {
+    if (pos == end || *pos != c) { comb_parser::detail::expected_char(pos, c); return false; }
+    ++pos;
+    return true;
+  }
+};
+
+// zero terminated literal
+template<typename Char>
+class lit : public base<lit<Char>> {
+  const Char* arr;
+public:
+  using attribute = unused;
+
+  constexpr lit(const Char* arr) : arr(arr) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, unused&) const {
+    auto start = pos;
+    auto it = arr;
+    for (; *it != 0 && pos != end && *it == *pos; ++it, ++pos) { }
+    if (*it == 0) return true;
+    comb_parser::detail::expected_char(pos, *it);
+    pos = start;
+    return false;
+  }
+};
+
+// chunk matched by recognizer r is converted to T with conv(pos, end, T&)
+template<typename T, typename R, typename Conv>
+class as_p : public base<as_p<T, R, Conv>> {
+  R r;
+  Conv conv;
+public:
+  using attribute = T;
+
+  as_p(R r, Conv conv) : r(std::move(r)), conv(std::move(conv)) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, T& out) const {
+    auto start = pos;
+    if (!r(pos, end)) return false;
+    if (conv(start, pos, out)) return true;
+    pos = start;
+    return false;
+  }
+};
+
+template<typename T, typename R, typename Conv>
+as_p<T, R, Conv> as(R r, Conv conv) { return {std::move(r), std::move(conv)}; }
+
+template<typename Char, typename Iter>
+as_p<unused, parser<Char, Iter>, detail::no_conv> match(const parser<Char, Iter>& p) { return {p, {}}; }
+
+template<typename Char, typename Iter>
+as_p<std::basic_string<Char>, parser<Char, Iter>, detail::text_conv> text(const parser<Char, Iter>& p) { return {p, {}}; }
+
+template<typename Char, typename Iter>
+as_p<std::basic_string_view<Char>, parser<Char, Iter>, detail::view_conv> view(const parser<Char, Iter>& p) { return {p, {}}; }
+
+template<typename T, typename Char, typename Iter>
+as_p<T, parser<Char, Iter>, detail::number_conv> number(const parser<Char, Iter>& p) { return {p, {}}; }
+
+//==========
+// Combinators
+
+template<typename A, typename B>
+class seq_p : public base<seq_p<A, B>> {
+  A a;
+  B b;
+  using attr_a = typename A::attribute;
+  using attr_b = typename B::attribute;
+public:
+  using attribute = detail::seq_attribute<attr_a, attr_b>;
+
+  seq_p(A a, B b) : a(std::move(a)), b(std::move(b)) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, attribute& out) const {
+    auto start = pos;
+    bool ok;
+    // when one of attributes is unused, the other one is parsed right into out
+    if constexpr (std::is_same_v<attr_a, unused> && std::is_same_v<attr_b, attribute>) {
+      unused u;
+      ok = a.parse(pos, end, u) && b.parse(pos, end, out);
+    } else if constexpr (std::is_same_v<attr_b, unused> && std::is_same_v<attr_a, attribute>) {
+      unused u;
+      ok = a.parse(pos, end, out) && b.parse(pos, end, u);
+    } else {
+      attr_a va{};
+      attr_b vb{};
+      ok = a.parse(pos, end, va) && b.parse(pos, end, vb);
+      if (ok) detail::assign_tuple(out, std::tuple_cat(detail::as_tuple(std::move(va)), detail::as_tuple(std::move(vb))));
+    }
+    if (!ok) pos = start;
+    return ok;
+  }
+};
+
+template<typename A, typename B>
+class alt_p : public base<alt_p<A, B>> {
+  A a;
+  B b;
+  using attr_a = typename A::attribute;
+  using attr_b = typename B::attribute;
+public:
+  using attribute = detail::alt_attribute<attr_a, attr_b>;
+
+  alt_p(A a, B b) : a(std::move(a)), b(std::move(b)) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, attribute& out) const {
+    return alternative(a, pos, end, out) || alternative(b, pos, end, out);
+  }
+
+private:
+  template<typename P, typename Iter>
+  static bool alternative(const P& p, Iter& pos, Iter end, attribute& out) {
+    if constexpr (std::is_same_v<typename P::attribute, attribute>) {
+      return p.parse(pos, end, out);
+    } else {
+      typename P::attribute v{};
+      if (!p.parse(pos, end, v)) return false;
+      detail::assign_alt(out, std::move(v));
+      return true;
+    }
+  }
+};
+
+template<typename P>
+class repeat_p : public base<repeat_p<P>> {
+  P p;
+  int from_times;
+  int to_times;
+  using attr_p = typename P::attribute;
+public:
+  using attribute = std::conditional_t<std::is_same_v<attr_p, unused>, unused, std::vector<attr_p>>;
+
+  repeat_p(P p, int from_times, int to_times) : p(std::move(p)), from_times(from_times), to_times(to_times) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, attribute& out) const {
+    auto start = pos;
+    int times = 0;
+    if constexpr (!std::is_same_v<attribute, unused>) out.clear();
+    while (to_times == -1 || times < to_times) {
+      auto before = pos;
+      if constexpr (std::is_same_v<attribute, unused>) {
+        if (!p.parse(pos, end, out)) break;
+      } else {
+        out.emplace_back();
+        if (!p.parse(pos, end, out.back())) { out.pop_back(); break; }
+      }
+      ++times;
+      if (pos == before) {
+        // p matched empty chunk, it will match it forever: the rest of minimum is matched the same way
+        if constexpr (!std::is_same_v<attribute, unused>) {
+          if (times < from_times) {
+            auto a = out.back();
+            out.resize(from_times, a);
+          }
+        }
+        times = std::max(times, from_times);
+        break;
+      }
+    }
+    if (times >= from_times) return true;
+    pos = start;
+    return false;
+  }
+};
+
+template<typename P>
+class optional_p : public base<optional_p<P>> {
+  P p;
+  using attr_p = typename P::attribute;
+public:
+  using attribute = std::conditional_t<std::is_same_v<attr_p, unused>, unused, std::optional<attr_p>>;
+
+  explicit optional_p(P p) : p(std::move(p)) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, attribute& out) const {
+    if constexpr (std::is_same_v<attribute, unused>) {
+      p.parse(pos, end, out);
+    } else {
+      out.emplace();
+      if (!p.parse(pos, end, *out)) out.reset();
+    }
+    return true;
+  }
+};
+
+template<typename P, typename F>
+class map_p : public base<map_p<P, F>> {
+  P p;
+  F f;
+  using attr_p = typename P::attribute;
+public:
+  using attribute = std::decay_t<typename std::conditional_t<std::is_same_v<attr_p, unused>,
+    std::invoke_result<const F&>, std::invoke_result<const F&, attr_p&&>>::type>;
+
+  map_p(P p, F f) : p(std::move(p)), f(std::move(f)) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, attribute& out) const {
+    attr_p v{};
+    if (!p.parse(pos, end, v)) return false;
+    if constexpr (std::is_same_v<attr_p, unused>) out = std::invoke(f);
+    else out = std::invoke(f, std::move(v));
+    return true;
+  }
+};
+
+// field binding: elements of attribute of p are moved into fields of S in order
+template<typename S, typename P, typename ...Fields>
+class into_p : public base<into_p<S, P, Fields...>> {
+  P p;
+  std::tuple<Fields S::*...> fields;
+  using attr_p = typename P::attribute;
+public:
+  using attribute = S;
+
+  into_p(P p, Fields S::*...fields) : p(std::move(p)), fields(fields...) { }
+
+  template<typename Iter>
+  bool parse(Iter& pos, Iter end, S& out) const {
+    if constexpr (sizeof...(Fields) == 1) {
+      return p.parse(pos, end, out.*std::get<0>(fields)); // single field is parsed in place
+    } else {
+      static_assert(detail::is_tuple<attr_p>::value && std::tuple_size_v<attr_p> == sizeof...(Fields),
+                    "number of fields should match number of elements of attribute");
+      attr_p v{};
+      if (!p.parse(pos, end, v)) return false;
+      std::apply([&](auto...f){
+        std::apply([&](auto&...e){ ((out.*f = std::move(e)), ...); }, v);
+      }, fields);
+      return true;
+    }
+  }
+};
+
+template<typename S, typename P, typename ...Fields>
+into_p<S, P, Fields...> into(const base<P>& p, Fields S::*...fields) { return {p.self(), fields...}; }
+
+template<typename P>
+repeat_p<P> repeat(const base<P>& p, int from_times = 0, int to_times = -1) { return {p.self(), from_times, to_times}; }
+
+template<typename A, typename B>
+seq_p<A, B> operator+(const base<A>& a, const base<B>& b) { return {a.self(), b.self()}; }
+
+template<typename A>
+seq_p<A, ch<char>> operator+(const base<A>& a, char c) { return {a.self(), c}; }
+
+template<typename A>
+seq_p<A, lit<char>> operator+(const base<A>& a, const char* s) { return {a.self(), s}; }
+
+template<typename B>
+seq_p<ch<char>, B> operator+(char c, const base<B>& b) { return {c, b.self()}; }
+
+template<typename B>
+seq_p<lit<char>, B> operator+(const char* s, const base<B>& b) { return {s, b.self()}; }
+
+template<typename A, typename B>
+alt_p<A, B> operator|(const base<A>& a, const base<B>& b) { return {a.self(), b.self()}; }
+
+template<typename P>
+optional_p<P> operator~(const base<P>& p) { return optional_p<P>{p.self()}; }
+
+template<typename P, typename F>
+map_p<P, F> operator%(const base<P>& p, F f) { return {p.self(), std::move(f)}; }
+
+//==========
+// Running
+
+template<typename P, typename Iter>
+bool parse(const base<P>& p, Iter& pos, Iter end, typename P::attribute& out) {
+  return p.self().parse(pos, end, out);
+}
+
+} // namespace comb_parser::attr
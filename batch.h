@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "comb_parser.h"
+#include "static_parser.h"
+#include "scan.h"
+
+// Parallel parsing of many independent inputs.
+//
+// Built grammars are immutable: parsers are called through const methods and do not modify
+// their captured state, so one grammar object may be shared by many threads.
+// Actions, converters and context generators supplied by user should be thread-safe too,
+// and every input should get its own context.
+
+namespace comb_parser {
+
+// Pool of threads with work stealing: range of indices is split between workers,
+// worker which has run out of work steals half of remaining range of other worker.
+class thread_pool {
+public:
+  explicit thread_pool(unsigned threads = std::thread::hardware_concurrency())
+    : queues(std::make_unique<queue[]>(std::max(threads, 1u))) {
+    threads = std::max(threads, 1u);
+    for (unsigned id = 0; id < threads; ++id) {
+      workers.emplace_back([this, id]{ worker_loop(id); });
+    }
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stop = true;
+    }
+    start_cv.notify_all();
+    for (auto& w: workers) w.join();
+  }
+
+  unsigned size() const { return workers.size(); }
+
+  // calls fn(index, worker) for every index in [0, n), blocks until all calls are done
+  void parallel_for(std::size_t n, std::function<void(std::size_t, unsigned)> fn) {
+    std::lock_guard<std::mutex> run_lock(run_m);
+    std::unique_lock<std::mutex> lock(m);
+    auto per_worker = n / size();
+    auto extra = n % size();
+    std::size_t lo = 0;
+    for (unsigned id = 0; id < size(); ++id) {
+      std::lock_guard<std::mutex> q_lock(queues[id].m);
+      queues[id].lo = lo;
+      lo += per_worker + (id < extra ? 1 : 0);
+      queues[id].hi = lo;
+    }
+    job = std::move(fn);
+    error = nullptr;
+    active = size();
+    ++generation;
+    start_cv.notify_all();
+    done_cv.wait(lock, [this]{ return active == 0; });
+    job = nullptr;
+    if (error) std::rethrow_exception(error);
+  }
+
+private:
+  struct alignas(64) queue {
+    std::mutex m;
+    std::size_t lo = 0;
+    std::size_t hi = 0;
+  };
+
+  std::vector<std::thread> workers;
+  std::unique_ptr<queue[]> queues;
+
+  std::mutex run_m; // one parallel_for at a time
+  std::mutex m;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  std::function<void(std::size_t, unsigned)> job;
+  std::exception_ptr error;
+  unsigned long generation = 0;
+  unsigned active = 0;
+  bool stop = false;
+
+  void worker_loop(unsigned id) {
+    unsigned long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(m);
+        start_cv.wait(lock, [&]{ return stop || generation != seen; });
+        if (stop) return;
+        seen = generation;
+      }
+      std::size_t idx;
+      try {
+        while (next(id, idx)) job(idx, id);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(m);
+        if (!error) error = std::current_exception();
+        drain();
+      }
+      std::lock_guard<std::mutex> lock(m);
+      if (--active == 0) done_cv.notify_one();
+    }
+  }
+
+  bool next(unsigned id, std::size_t& idx) {
+    {
+      std::lock_guard<std::mutex> lock(queues[id].m);
+      if (queues[id].lo < queues[id].hi) {
+        idx = queues[id].lo++;
+        return true;
+      }
+    }
+    for (unsigned i = 1; i < size(); ++i) {
+      auto& victim = queues[(id + i) % size()];
+      std::size_t lo, hi;
+      {
+        std::lock_guard<std::mutex> lock(victim.m);
+        if (victim.lo >= victim.hi) continue;
+        auto count = (victim.hi - victim.lo + 1) / 2;
+        hi = victim.hi;
+        lo = hi - count;
+        victim.hi = lo;
+      }
+      std::lock_guard<std::mutex> lock(queues[id].m);
+      queues[id].lo = lo + 1;
+      queues[id].hi = hi;
+      idx = lo;
+      return true;
+    }
+    return false;
+  }
+
+  // on error remaining work is dropped
+  void drain() {
+    for (unsigned id = 0; id < size(); ++id) {
+      std::lock_guard<std::mutex> lock(queues[id].m);
+      queues[id].lo = queues[id].hi;
+    }
+  }
+};
+
+// Parses inputs[i] with contexts[i] in parallel, effects are not applied,
+// they are returned in order of inputs.
+template<typename Grammar, typename Inputs, typename Contexts>
+std::vector<result> parse_batch(thread_pool& pool, const Grammar& grammar, Inputs& inputs, Contexts& contexts) {
+  std::vector<result> results(std::size(inputs));
+  pool.parallel_for(results.size(), [&](std::size_t i, unsigned){
+    auto pos = std::begin(inputs[i]);
+    results[i] = grammar(pos, std::end(inputs[i]), contexts[i]);
+  });
+  return results;
+}
+
+// Parses inputs[i] with contexts[i] in parallel, effects are applied by worker right after
+// successful parse. Static grammars use per-thread state, so their effect arenas are reused.
+// Returns success flag for every input.
+template<typename Grammar, typename Inputs, typename Contexts>
+std::vector<bool> parse_batch_apply(thread_pool& pool, const Grammar& grammar, Inputs& inputs, Contexts& contexts) {
+  std::vector<char> matched(std::size(inputs)); // not vector<bool>, elements are written concurrently
+  if constexpr (st::is_parser_v<Grammar>) {
+    using Iter = decltype(std::begin(inputs[0]));
+    std::vector<st::state<Iter>> states(pool.size());
+    pool.parallel_for(matched.size(), [&](std::size_t i, unsigned worker){
+      auto pos = std::begin(inputs[i]);
+      matched[i] = st::parse(grammar, pos, std::end(inputs[i]), states[worker], contexts[i]);
+    });
+  } else {
+    pool.parallel_for(matched.size(), [&](std::size_t i, unsigned){
+      auto pos = std::begin(inputs[i]);
+      auto r = grammar(pos, std::end(inputs[i]), contexts[i]);
+      if (r) r();
+      matched[i] = static_cast<bool>(r);
+    });
+  }
+  return {matched.begin(), matched.end()};
+}
+
+namespace detail {
+
+// items separated by single separator chars: repeat(item + ~separator),
+// effects are appended to results, returns true if last consumed char is separator,
+// last_item is start of the last parsed item
+template<typename P, typename Iter, typename...Args>
+bool sep_by(const P& item, const scan::table& sep, Iter& pos, Iter end, std::vector<result>& results,
+            Iter& last_item, Args...args) {
+  bool sep_last = false;
+  last_item = pos;
+  while (pos != end) {
+    auto before = pos;
+    auto r = item(pos, end, args...);
+    if (!r) break;
+    last_item = before;
+    results.push_back(std::move(r));
+    sep_last = pos != end && sep.contains(*pos);
+    if (sep_last) ++pos;
+    if (pos == before) break;
+  }
+  return sep_last;
+}
+
+inline result sequence_of(std::vector<result> results) {
+  if (results.empty()) return success;
+  return [results = std::move(results)]{
+    for (auto& r: results) r();
+  };
+}
+
+} // namespace detail
+
+// combinator 'parallel separated list': parallel_sep_by(pool, item, separators) - same as
+// repeat(item + ~separator), where separator is one char from 'separators' charset, but big input
+// is split by separators into chunks (with scanning kernels), which are parsed in parallel.
+// Effects of chunks are merged in original order.
+// If some chunk is not parsed exactly up to the separator at its end, or its last item parsed
+// against whole input goes past that separator (i.e. separator may occur inside of item, and
+// boundary of chunk is ambiguous), whole input is parsed sequentially.
+// During parsing stage contexts are shared between threads, so item parser should modify them
+// only in effects. It should not be used inside of other parallel work of the same pool.
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> parallel_sep_by(thread_pool& pool, const parser<Char, Iter, Args...> item,
+                                                  const charset::charset& separators, std::size_t min_chunk = 1 << 16) {
+  auto sep = std::make_shared<scan::table>(separators);
+  return parser<Char, Iter, Args...>{[=, &pool](Iter& pos, Iter end, Args...args)->result{
+    auto length = static_cast<std::size_t>(end - pos);
+    auto chunks = std::min<std::size_t>(pool.size() * 4, length / min_chunk);
+    if (chunks >= 2) {
+      // chunks start just after separators
+      std::vector<Iter> bounds{pos};
+      for (std::size_t k = 1; k < chunks; ++k) {
+        auto target = pos + k * (length / chunks);
+        if (target < bounds.back()) continue;
+        auto s = scan::find(*sep, target, end);
+        if (s == end) break;
+        bounds.push_back(s + 1);
+      }
+      bounds.push_back(end);
+
+      auto n = bounds.size() - 1;
+      std::vector<std::vector<result>> results(n);
+      std::vector<char> clean(n);
+      Iter last_pos = bounds[n - 1];
+      pool.parallel_for(n, [&](std::size_t k, unsigned){
+        auto p = bounds[k];
+        Iter last_item;
+        bool sep_last = detail::sep_by(item, *sep, p, bounds[k + 1], results[k], last_item, args...);
+        clean[k] = k == n - 1 || (p == bounds[k + 1] && sep_last);
+        if (clean[k] && k != n - 1) {
+          // last item was parsed up to chunk end, with whole input it may go past the separator
+          auto q = last_item;
+          clean[k] = item(q, end, args...) && q == bounds[k + 1] - 1;
+        }
+        if (k == n - 1) last_pos = p;
+      });
+
+      if (std::all_of(clean.begin(), clean.end(), [](char c){ return c; })) {
+        std::vector<result> merged;
+        for (auto& r: results) std::move(r.begin(), r.end(), std::back_inserter(merged));
+        pos = last_pos;
+        return detail::sequence_of(std::move(merged));
+      }
+    }
+    std::vector<result> results;
+    Iter last_item;
+    detail::sep_by(item, *sep, pos, end, results, last_item, args...);
+    return detail::sequence_of(std::move(results));
+  }};
+}
+
+} // namespace comb_parser
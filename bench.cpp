@@ -0,0 +1,607 @@
+#include "comb_parser.h"
+#include "static_parser.h"
+#include "ast.h"
+#include "attr.h"
+#include "vm.h"
+#include "utf8.h"
+#include "charset.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Benchmark suite.
+//
+// Microbenchmarks of combinators, charset scans, literals, repeat with effects and converters,
+// and end-to-end throughput on generated URI, query-string and log-line corpora of several sizes.
+// Every case is run with growing number of iterations until it takes at least --min-time seconds
+// (like Google Benchmark does). Reported: time per operation, MB/s, parses/s and allocations
+// per parse (global operator new is counted). Results are printed as table and, with --json=path,
+// written as JSON, so regressions may be tracked over time.
+//
+//   ./bench [--min-time=0.2] [--filter=substring] [--json=bench.json]
+
+namespace cp = comb_parser;
+namespace st = cp::st;
+
+using cs = cp::charset::charset;
+
+//===============
+// allocation counting
+
+static std::atomic<std::size_t> allocations{0};
+
+// all of plain, array and sized forms go through these two, so every allocation is counted and
+// every pointer is freed by the same function that allocated it (not inlined: gcc would pair
+// builtin new with free and warn about mismatch)
+[[gnu::noinline]] static void* counted_alloc(std::size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n ? n : 1)) return p;
+  throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] static void counted_free(void* p) noexcept { std::free(p); }
+
+void* operator new(std::size_t n) { return counted_alloc(n); }
+void* operator new[](std::size_t n) { return counted_alloc(n); }
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_free(p); }
+
+//===============
+// harness
+
+// one operation of benchmark processes 'bytes' bytes of input in 'items' parses
+struct work {
+  std::size_t bytes;
+  std::size_t items;
+};
+
+struct bench_case {
+  std::string name;
+  std::function<work()> op;
+};
+
+struct bench_result {
+  std::string name;
+  std::size_t iterations;
+  double ns_per_op;
+  double mb_per_s;
+  double items_per_s;
+  double allocs_per_item;
+};
+
+static std::vector<bench_case>& registry() {
+  static std::vector<bench_case> cases;
+  return cases;
+}
+
+static void add(std::string name, std::function<work()> op) {
+  registry().push_back({std::move(name), std::move(op)});
+}
+
+static bench_result run(const bench_case& c, double min_time) {
+  c.op(); // warm up
+  std::size_t iterations = 1;
+  for (;;) {
+    work w{0, 0};
+    auto allocs_before = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+      auto one = c.op();
+      w.bytes += one.bytes;
+      w.items += one.items;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    auto allocs = allocations.load(std::memory_order_relaxed) - allocs_before;
+    if (elapsed.count() >= min_time || iterations >= (std::size_t{1} << 30)) {
+      return {c.name, iterations,
+              elapsed.count() * 1e9 / iterations,
+              w.bytes / elapsed.count() / 1e6,
+              w.items / elapsed.count(),
+              w.items ? static_cast<double>(allocs) / w.items : 0.0};
+    }
+    // aim a bit over min_time
+    double factor = elapsed.count() > 0 ? min_time * 1.4 / elapsed.count() : 10;
+    iterations = static_cast<std::size_t>(iterations * std::min(std::max(factor, 2.0), 10.0));
+  }
+}
+
+static std::string json_escape(const std::string& s) {
+  std::string out;
+  for (char c: s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+static void write_json(std::ostream& out, const std::vector<bench_result>& results, double min_time) {
+  out << "{\n  \"context\": {\"min_time\": " << min_time
+#ifdef __VERSION__
+      << ", \"compiler\": \"" << json_escape(__VERSION__) << "\""
+#endif
+      << "},\n  \"benchmarks\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    out << "    {\"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations
+        << ", \"ns_per_op\": " << r.ns_per_op << ", \"mb_per_s\": " << r.mb_per_s
+        << ", \"items_per_s\": " << r.items_per_s << ", \"allocs_per_item\": " << r.allocs_per_item << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+// keeps results alive, so that compiler does not throw work away
+static std::size_t sink = 0;
+
+//===============
+// URI grammar from test.cpp, built twice: from dynamic parsers and from static ones.
+// Both variants do the same work, including effects.
+
+const cs alpha{"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"};
+const cs digit{"0123456789"};
+const cs hexdigit{digit + cs{"ABCDEFabcdef"}};
+
+struct uri_info{
+  std::string schema;
+  std::string authority;
+  std::vector<std::string> path;
+  std::vector<std::string> params;
+  std::string fragment;
+};
+
+using Iter = std::string::const_iterator;
+
+const auto store = [](std::string uri_info::* field) {
+  return [=](Iter s, Iter e, uri_info* ui) -> cp::result {
+    return [=]{ ui->*field = std::string(s, e); };
+  };
+};
+
+const auto append = [](std::vector<std::string> uri_info::* field) {
+  return [=](Iter s, Iter e, uri_info* ui) -> cp::result {
+    return [=]{ (ui->*field).emplace_back(s, e); };
+  };
+};
+
+namespace dynamic_uri {
+
+using p = cp::parser<char, Iter>;
+using up = p::with_context<uri_info*>;
+
+const p decimal = p{digit};
+const p hex = p{hexdigit};
+
+const p IPv4 = repeat(decimal + p{'.'}, 3, 3) + decimal;
+const p IPv6 = ([]{
+    const p hextet{hex + p{':'}};
+    const p v1 = repeat(hextet, 7,7) + hex;
+    const p v2 = p{"::"} >> ~(repeat(hextet) + hex);
+    const p v3 = repeat(hextet) + p{':'} + ~(repeat(hextet) + hex);
+    return (v1 | v2 | v3);
+  }());
+
+const p FQDN = p{alpha + digit + cs{".-"}};
+const p uri_host = p{'['} + IPv6 + p{']'} | IPv4 | FQDN;
+
+const up schema = up{p{!cs{":/?#"}}} % up::keywords({"http", "https", "ftp"}) % store(&uri_info::schema);
+const up host = up{uri_host} % store(&uri_info::authority);
+const up authority = up{!cs{"/?#"}} % (host + ~(up{':'} >> up{decimal}) + up::end());
+const up path = repeat(up{'/'} >> ~(up{!cs{"/?#"}} % append(&uri_info::path)));
+const up params = repeat((up{!cs{"&#;"}} % append(&uri_info::params)) + ~(up{'&'} | up{';'}));
+const up fragment = up{!cs{}} % store(&uri_info::fragment);
+
+const up uri = ~(schema + up{':'}) + ~(up{"//"} >> ~authority) + ~path + ~(up{'?'} >> params) + ~(up{'#'} >> ~fragment);
+
+} // namespace dynamic_uri
+
+namespace static_uri {
+
+const auto decimal = st::span{digit};
+const auto hex = st::span{hexdigit};
+
+const auto IPv4 = repeat(decimal + st::ch{'.'}, 3, 3) + decimal;
+const auto hextet = hex + st::ch{':'};
+const auto IPv6 =
+    (repeat(hextet, 7,7) + hex)
+  | (st::lit{"::"} >> ~(repeat(hextet) + hex))
+  | (repeat(hextet) + st::ch{':'} + ~(repeat(hextet) + hex));
+
+const auto FQDN = st::span{alpha + digit + cs{".-"}};
+const auto uri_host = st::ch{'['} + IPv6 + st::ch{']'} | IPv4 | FQDN;
+
+const auto schema = st::span{!cs{":/?#"}} % st::keywords("http", "https", "ftp") % store(&uri_info::schema);
+const auto host = uri_host % store(&uri_info::authority);
+const auto authority = st::span{!cs{"/?#"}} % (host + ~(st::ch{':'} >> decimal) + st::end{});
+const auto path = repeat(st::ch{'/'} >> ~(st::span{!cs{"/?#"}} % append(&uri_info::path)));
+const auto params = repeat((st::span{!cs{"&#;"}} % append(&uri_info::params)) + ~(st::ch{'&'} | st::ch{';'}));
+const auto fragment = st::span{!cs{}} % store(&uri_info::fragment);
+
+const auto uri = ~(schema + st::ch{':'}) + ~(st::lit{"//"} >> ~authority) + ~path + ~(st::ch{'?'} >> params) + ~(st::ch{'#'} >> ~fragment);
+
+} // namespace static_uri
+
+// typed attributes are written straight into uri_info, there are no effect closures
+namespace typed_uri {
+
+namespace at = cp::attr;
+using p = dynamic_uri::p;
+
+const auto value_or_empty = [](auto v){ return v ? std::move(*v) : typename decltype(v)::value_type{}; };
+
+const auto schema = at::text(p::keywords({"http", "https", "ftp"}));
+const auto authority = at::text(dynamic_uri::uri_host) + ~(':' + at::match(dynamic_uri::decimal));
+const auto path = repeat('/' + at::text(~p{!cs{"/?#"}}));
+const auto params = repeat(at::text(p{!cs{"&#;"}}) + ~(at::ch{'&'} | at::ch{';'}));
+const auto fragment = at::text(~p{!cs{}});
+
+const auto uri = at::into<uri_info>(
+  (~(schema + ':') % value_or_empty) + (~("//" + authority) % value_or_empty) + path
+    + (~('?' + params) % value_or_empty) + (~('#' + fragment) % value_or_empty),
+  &uri_info::schema, &uri_info::authority, &uri_info::path, &uri_info::params, &uri_info::fragment);
+
+} // namespace typed_uri
+
+//===============
+// query strings: key=value pairs separated by '&'
+
+using query = std::vector<std::pair<std::string_view, std::string_view>>;
+
+namespace query_grammar {
+
+using p = cp::parser<char, const char*>;
+using qp = p::with_context<query*>;
+
+const cs key_chars = !cs{"=&"};
+const cs value_chars = !cs{"&"};
+
+const auto to_view = qp::make_converter<std::string_view>(cp::view_conv);
+const qp pair = qp{key_chars} % (to_view % [](auto k, query* q)->cp::result{ return [=]{ q->emplace_back(k(), std::string_view{}); }; })
+              + ~(qp{'='} >> (qp{value_chars} % (to_view % [](auto v, query* q)->cp::result{ return [=]{ q->back().second = v(); }; })));
+const qp dynamic_query = pair + repeat(qp{'&'} >> pair);
+
+const auto view_of = [](const char* s, const char* e){ return std::string_view(s, e - s); };
+const auto static_pair = st::span{key_chars} % [](const char* s, const char* e, query* q){ return [=]{ q->emplace_back(view_of(s, e), std::string_view{}); }; }
+                       + ~(st::ch{'='} >> (st::span{value_chars} % [](const char* s, const char* e, query* q){ return [=]{ q->back().second = view_of(s, e); }; }));
+const auto static_query = static_pair + repeat(st::ch{'&'} >> static_pair);
+
+} // namespace query_grammar
+
+//===============
+// log lines: 127.0.0.1 - - [10/Oct/2000:13:55:36 +0000] "GET /index.html HTTP/1.1" 200 2326
+
+struct log_stats {
+  std::size_t lines = 0;
+  std::size_t errors = 0;
+  std::size_t bytes = 0;
+};
+
+namespace log_grammar {
+
+const auto to_int = [](const char* s, const char* e) {
+  int v = 0;
+  std::from_chars(s, e, v);
+  return v;
+};
+
+const auto ip = repeat(st::span{digit} + st::ch{'.'}, 3, 3) + st::span{digit};
+const auto date = st::ch{'['} + st::span{!cs{"]"}} + st::ch{']'};
+const auto request = st::ch{'"'} + st::keywords("GET", "POST", "PUT", "DELETE", "HEAD") + st::ch{' '}
+                   + st::span{!cs{" \""}} + st::lit{" HTTP/1."} + st::span{digit} + st::ch{'"'};
+const auto status = st::span{digit} % [](const char* s, const char* e, log_stats* ls){
+  return [ls, code = to_int(s, e)]{ ls->errors += code >= 400; };
+};
+const auto size = st::span{digit} % [](const char* s, const char* e, log_stats* ls){
+  return [ls, n = to_int(s, e)]{ ls->bytes += n; ++ls->lines; };
+};
+const auto line = ip + st::lit{" - - "} + date + st::ch{' '} + request + st::ch{' '} + status + st::ch{' '} + size + st::ch{'\n'};
+const auto log = repeat(line) + st::end{};
+
+using p = cp::parser<char, const char*, log_stats*>;
+const p dynamic_log = p{log};
+
+} // namespace log_grammar
+
+//===============
+// corpora, generated with fixed seed
+
+static std::vector<std::string> uri_corpus(std::size_t n) {
+  std::mt19937 rng{42};
+  const char* schemes[] = {"http", "https", "ftp"};
+  const char* words[] = {"index", "api", "v1", "users", "images", "static", "search", "a", "docs", "archive"};
+  std::vector<std::string> out;
+  for (std::size_t i = 0; i < n; ++i) {
+    std::string u = schemes[rng() % 3];
+    u += "://";
+    switch (rng() % 3) {
+      case 0: u += "www.example" + std::to_string(rng() % 100) + ".com"; break;
+      case 1: u += std::to_string(rng() % 256) + "." + std::to_string(rng() % 256) + ".0." + std::to_string(rng() % 256); break;
+      case 2: u += "[2001:db8::" + std::to_string(rng() % 9999) + "]"; break;
+    }
+    if (rng() % 2) u += ":" + std::to_string(1 + rng() % 9000);
+    for (unsigned k = rng() % 5; k > 0; --k) u += std::string("/") + words[rng() % 10];
+    if (rng() % 2) {
+      u += "?";
+      for (unsigned k = 1 + rng() % 4; k > 0; --k) u += std::string(words[rng() % 10]) + "=" + std::to_string(rng() % 100000) + (k > 1 ? "&" : "");
+    }
+    if (rng() % 4 == 0) u += "#top";
+    out.push_back(std::move(u));
+  }
+  return out;
+}
+
+static std::vector<std::string> query_corpus(std::size_t n) {
+  std::mt19937 rng{7};
+  const char* keys[] = {"q", "page", "sort", "lang", "session", "utm_source", "filter", "id"};
+  std::vector<std::string> out;
+  for (std::size_t i = 0; i < n; ++i) {
+    std::string q;
+    for (unsigned k = 1 + rng() % 8; k > 0; --k) {
+      q += keys[rng() % 8];
+      q += "=" + std::to_string(rng()) + (rng() % 3 ? "abc" : "");
+      if (k > 1) q += "&";
+    }
+    out.push_back(std::move(q));
+  }
+  return out;
+}
+
+static std::string log_corpus(std::size_t n) {
+  std::mt19937 rng{11};
+  const char* methods[] = {"GET", "POST", "PUT", "DELETE", "HEAD"};
+  const int codes[] = {200, 200, 200, 304, 404, 500};
+  std::string out;
+  for (std::size_t i = 0; i < n; ++i) {
+    out += std::to_string(rng() % 256) + "." + std::to_string(rng() % 256) + "." + std::to_string(rng() % 256) + ".1";
+    out += " - - [10/Oct/2000:13:55:" + std::to_string(10 + rng() % 50) + " +0000] \"";
+    out += methods[rng() % 5];
+    out += " /static/file" + std::to_string(rng() % 1000) + ".html HTTP/1.1\" ";
+    out += std::to_string(codes[rng() % 6]) + " " + std::to_string(rng() % 100000) + "\n";
+  }
+  return out;
+}
+
+//===============
+// microbenchmarks
+
+static void register_micro() {
+  using dp = cp::parser<char, const char*>;
+
+  const std::string text_4k = std::string(4096, 'a') + "/";
+  const std::string digits_4k = std::string(4096, '7');
+
+  auto once = [](std::string input, auto p) {
+    return [input = std::move(input), p]{
+      const char* pos = input.data();
+      auto r = p(pos, input.data() + input.size());
+      sink += static_cast<bool>(r);
+      if (r) r();
+      return work{static_cast<std::size_t>(pos - input.data()), 1};
+    };
+  };
+  auto once_static = [](std::string input, auto p) {
+    return [input = std::move(input), p, s = std::make_shared<st::state<const char*>>()]{
+      const char* pos = input.data();
+      sink += st::parse(p, pos, input.data() + input.size(), *s);
+      return work{static_cast<std::size_t>(pos - input.data()), 1};
+    };
+  };
+
+  add("micro/char", once("x", dp{'x'}));
+  add("micro/literal", once("https://", dp{"https"}));
+  add("micro/choice of literals", once("ftp://", dp{"http"} | dp{"https"} | dp{"ftp"}));
+  add("micro/keywords", once("ftp://", dp::keywords({"http", "https", "ftp"})));
+  {
+    using g = cp::ast::expr<char, const char*>;
+    add("micro/ast dispatch choice", once("ftp://", (g{"http"} | g{"https"} | g{"ftp"}).optimize().compile()));
+    add("micro/vm choice", once("ftp://", cp::vm::program{(g{"http"} | g{"https"} | g{"ftp"}).optimize()}.as_parser()));
+    const g list = repeat((g{cs{"abcdefghijklmnopqrstuvwxyz"}} | g{cs{"0123456789"}}) + ~g{','});
+    std::string items_4k;
+    while (items_4k.size() < 4096) items_4k += "abc,123,x,42,";
+    add("micro/ast repeat of choice 4KB", once(items_4k, list.optimize().compile()));
+    add("micro/vm repeat of choice 4KB", once(items_4k, cp::vm::program{list.optimize()}.as_parser()));
+  }
+  add("micro/longest", once("integer", longest(dp{"in"}, dp{"int"}, dp{cs{"abcdefghijklmnopqrstuvwxyz"}})));
+  add("micro/sequence", once("a1b2c3", dp{'a'} + dp{'1'} + dp{'b'} + dp{'2'} + dp{'c'} + dp{'3'}));
+  add("micro/optional", once("b", ~dp{'a'} + dp{'b'}));
+  add("micro/negation", once("b", !dp{'a'} + dp{'b'}));
+
+  add("micro/span predicate 4KB", once(text_4k, dp{std::function<bool(char)>{[](char c){ return c != '/'; }}}));
+  add("micro/span charset 4KB", once(text_4k, dp{!cs{"/"}}));
+  add("micro/static span 4KB", once_static(text_4k, st::span{!cs{"/"}}));
+  {
+    namespace u8 = cp::utf8;
+    using up = cp::parser<char32_t, u8::iterator<const char*>>;
+    std::string mixed_4k;
+    while (mixed_4k.size() < 4096) mixed_4k += "international-straße-домен-";
+    auto once_utf8 = [](std::string input, up p) {
+      return [input = std::move(input), p]{
+        auto pos = u8::begin(input);
+        sink += static_cast<bool>(p(pos, u8::end(input)));
+        return work{static_cast<std::size_t>(pos.base() - input.data()), 1};
+      };
+    };
+    const u8::charset label = u8::charset{cs{"abcdefghijklmnopqrstuvwxyz-"}} + u8::charset{U"ß"} + u8::charset::range(0x430, 0x44F);
+    add("micro/utf8 span ASCII 4KB", once_utf8(text_4k, up{label}));
+    add("micro/utf8 span mixed 4KB", once_utf8(mixed_4k, up{label}));
+    add("micro/utf8 validate ASCII 4KB", [=]{
+      sink += u8::validate(text_4k).ascii;
+      return work{text_4k.size(), 1};
+    });
+    add("micro/utf8 validate mixed 4KB", [=]{
+      sink += u8::validate(mixed_4k).valid;
+      return work{mixed_4k.size(), 1};
+    });
+  }
+  add("micro/somewhere 4KB", once(text_4k, somewhere(dp{'/'}, cs{"/"})));
+
+  std::size_t counter = 0;
+  auto count = [&counter](const char*, const char*)->cp::result{ return [&counter]{ ++counter; }; };
+  add("micro/repeat 1K with effects", once(std::string(1024, 'a'), repeat(dp{'a'} % count)));
+  add("micro/repeat 1K without effects", once(std::string(1024, 'a'), repeat(dp{'a'})));
+  add("micro/static repeat 1K with effects", once_static(std::string(1024, 'a'),
+        repeat(st::ch{'a'} % [&counter](const char*, const char*){ return [&counter]{ ++counter; }; })));
+
+  int number = 0;
+  const auto to_number = dp::make_converter<int>(cp::number_conv<int>);
+  add("micro/number converter", once("123456", dp{digit} % (to_number % [&number](auto v)->cp::result{
+        return [&number, v]{ number = v(); }; })));
+  std::string_view view;
+  const auto to_view = dp::make_converter<std::string_view>(cp::view_conv);
+  add("micro/view converter", once("abcdef", dp{alpha} % (to_view % [&view](auto v)->cp::result{
+        return [&view, v]{ view = v(); }; })));
+  add("micro/digits 4KB", once(digits_4k, dp{digit}));
+
+  // layered context: generator on every attempt vs. pooled lazy frames
+  const std::string pairs = "a=1;b;c=2;d;e=3;f;g=4;h";
+  using sp = dp::with_context<std::shared_ptr<std::string>>;
+  const sp shared_pair = sp{alpha} % [](const char* s, const char* e, auto name){ name->assign(s, e); return cp::success; };
+  add("micro/context generator", once(pairs, repeat(
+        ((shared_pair + sp{'='} + sp{digit}) * [](){ return std::make_shared<std::string>(); } | dp{alpha}) + ~dp{';'})));
+  using lp = dp::with_context<cp::lazy_context<std::string>>;
+  const lp lazy_pair = lp{alpha} % [](const char* s, const char* e, auto name){ name->assign(s, e); return cp::success; };
+  add("micro/context pool", once(pairs, repeat(
+        ((lazy_pair + lp{'='} + lp{digit}) * cp::context_pool<std::string>{} | dp{alpha}) + ~dp{';'})));
+}
+
+//===============
+// throughput on corpora
+
+static void register_throughput() {
+  for (std::size_t n: {100, 10000}) {
+    auto corpus = std::make_shared<std::vector<std::string>>(uri_corpus(n));
+    std::size_t bytes = 0;
+    for (auto& u: *corpus) bytes += u.size();
+
+    add("uri/dynamic/" + std::to_string(n), [=]{
+      for (auto& url: *corpus) {
+        uri_info ui;
+        auto pos = url.cbegin();
+        auto r = dynamic_uri::uri(pos, url.cend(), &ui);
+        if (r) { r(); sink += pos == url.cend(); }
+      }
+      return work{bytes, corpus->size()};
+    });
+
+    auto state = std::make_shared<st::state<Iter>>();
+    add("uri/static/" + std::to_string(n), [=]{
+      for (auto& url: *corpus) {
+        uri_info ui;
+        auto pos = url.cbegin();
+        if (st::parse(static_uri::uri, pos, url.cend(), *state, &ui)) sink += pos == url.cend();
+      }
+      return work{bytes, corpus->size()};
+    });
+
+    add("uri/typed/" + std::to_string(n), [=]{
+      for (auto& url: *corpus) {
+        uri_info ui;
+        auto pos = url.cbegin();
+        if (cp::attr::parse(typed_uri::uri, pos, url.cend(), ui)) sink += pos == url.cend();
+      }
+      return work{bytes, corpus->size()};
+    });
+  }
+
+  for (std::size_t n: {100, 10000}) {
+    auto corpus = std::make_shared<std::vector<std::string>>(query_corpus(n));
+    std::size_t bytes = 0;
+    for (auto& q: *corpus) bytes += q.size();
+
+    add("query/dynamic/" + std::to_string(n), [=]{
+      query q;
+      for (auto& s: *corpus) {
+        q.clear();
+        const char* pos = s.data();
+        auto r = query_grammar::dynamic_query(pos, s.data() + s.size(), &q);
+        if (r) { r(); sink += q.size(); }
+      }
+      return work{bytes, corpus->size()};
+    });
+
+    auto state = std::make_shared<st::state<const char*>>();
+    add("query/static/" + std::to_string(n), [=]{
+      query q;
+      for (auto& s: *corpus) {
+        q.clear();
+        const char* pos = s.data();
+        const char* end = s.data() + s.size();
+        if (st::parse(query_grammar::static_query, pos, end, *state, &q)) sink += q.size();
+      }
+      return work{bytes, corpus->size()};
+    });
+  }
+
+  for (std::size_t n: {100, 10000, 100000}) {
+    auto corpus = std::make_shared<std::string>(log_corpus(n));
+    auto state = std::make_shared<st::state<const char*>>();
+    add("log/static/" + std::to_string(n), [=]{
+      log_stats ls;
+      const char* pos = corpus->data();
+      const char* end = corpus->data() + corpus->size();
+      sink += st::parse(log_grammar::log, pos, end, *state, &ls);
+      sink += ls.lines;
+      return work{corpus->size(), n};
+    });
+    add("log/type-erased/" + std::to_string(n), [=]{
+      log_stats ls;
+      const char* pos = corpus->data();
+      auto r = log_grammar::dynamic_log(pos, corpus->data() + corpus->size(), &ls);
+      if (r) r();
+      sink += ls.lines;
+      return work{corpus->size(), n};
+    });
+  }
+}
+
+int main(int argc, char** argv)
+{
+  double min_time = 0.2;
+  std::string filter;
+  std::string json_path;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--min-time=", 0) == 0) min_time = std::stod(arg.substr(11));
+    else if (arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+    else if (arg.rfind("--json=", 0) == 0) json_path = arg.substr(7);
+    else {
+      std::cerr << "usage: " << argv[0] << " [--min-time=seconds] [--filter=substring] [--json=path]" << std::endl;
+      return 1;
+    }
+  }
+
+  register_micro();
+  register_throughput();
+
+  std::vector<bench_result> results;
+  std::cout << std::left << std::setw(40) << "benchmark" << std::right
+            << std::setw(14) << "ns/op" << std::setw(12) << "MB/s" << std::setw(14) << "parses/s"
+            << std::setw(14) << "allocs/parse" << std::endl;
+  for (auto& c: registry()) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+    auto r = run(c, min_time);
+    std::cout << std::left << std::setw(40) << r.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << r.ns_per_op << std::setw(12) << r.mb_per_s
+              << std::setw(14) << std::setprecision(0) << r.items_per_s
+              << std::setw(14) << std::setprecision(2) << r.allocs_per_item << std::endl;
+    results.push_back(std::move(r));
+  }
+
+  if (!json_path.empty()) {
+    std::ofstream out(json_path);
+    write_json(out, results, min_time);
+  }
+  return sink == 0; // nothing matched: broken grammars
+}
@@ -3,14 +3,72 @@
 #include <stdint.h>
 #include <array>
 #include <functional>
+#include <string>
+#include <type_traits>
 
 namespace comb_parser::charset {
 
+// Charset built at compile time.
+// Set algebra is folded by compiler, and contains() is single load-and-test.
+// Runtime charset may be constructed from it, so it may be used everywhere charset is used.
+//
+//   constexpr static_charset alpha = static_charset::range('a', 'z') + static_charset::range('A', 'Z');
+//   constexpr static_charset path_char = !static_charset{"/?#"};
+class static_charset {
+public:
+  constexpr static_charset() { }
+
+  constexpr static_charset(const char* s) {
+    for (; *s; ++s) set(static_cast<uint8_t>(*s));
+  }
+
+  static constexpr static_charset range(uint8_t from, uint8_t to) {
+    static_charset cs;
+    for (unsigned c = from; c <= to; ++c) cs.set(static_cast<uint8_t>(c));
+    return cs;
+  }
+
+  constexpr bool contains(uint8_t c) const {
+    return (bitmap[c >> 6] & (uint64_t{1} << (c & 0x3F))) != 0;
+  }
+
+  constexpr bool operator()(uint8_t c) const { return contains(c); }
+
+  constexpr static_charset operator+(const static_charset& c) const {
+    static_charset cs;
+    for (int i = 0; i < 4; ++i) cs.bitmap[i] = bitmap[i] | c.bitmap[i];
+    return cs;
+  }
+
+  constexpr static_charset operator-(const static_charset& c) const {
+    static_charset cs;
+    for (int i = 0; i < 4; ++i) cs.bitmap[i] = bitmap[i] & ~c.bitmap[i];
+    return cs;
+  }
+
+  constexpr static_charset operator!() const {
+    static_charset cs;
+    for (int i = 0; i < 4; ++i) cs.bitmap[i] = ~bitmap[i];
+    return cs;
+  }
+
+  constexpr bool operator==(const static_charset& c) const {
+    return bitmap[0] == c.bitmap[0] && bitmap[1] == c.bitmap[1] && bitmap[2] == c.bitmap[2] && bitmap[3] == c.bitmap[3];
+  }
+
+  constexpr std::array<uint64_t, 4> bits() const { return {bitmap[0], bitmap[1], bitmap[2], bitmap[3]}; }
+
+private:
+  uint64_t bitmap[4] = {0, 0, 0, 0};
+
+  constexpr void set(uint8_t c) { bitmap[c >> 6] |= uint64_t{1} << (c & 0x3F); }
+};
+
 class charset : public std::function<bool(uint8_t)> {
 public:
 
-  bool operator()(uint8_t c) {
-    return (bitmap[(c) >> 6] & ( 1 << ((c) & 0x3F))) != 0;
+  bool operator()(uint8_t c) const {
+    return (bitmap[(c) >> 6] & (uint64_t{1} << ((c) & 0x3F))) != 0;
   }
 
   charset() { }
@@ -18,14 +76,18 @@ public:
   charset(const std::function<bool(uint8_t)>& c) {
     for (int idx = 0; idx < 256; ++idx) {
       if(c(static_cast<unsigned char>(idx))) {
-        bitmap[idx >> 6] |= 1 << (idx & 0x3F);
+        bitmap[idx >> 6] |= uint64_t{1} << (idx & 0x3F);
       }
     }
   }
 
+  // template, so that string literals are not converted to static_charset implicitly
+  template<typename T, typename = std::enable_if_t<std::is_same_v<T, static_charset>>>
+  charset(const T& cs) : bitmap(cs.bits()) { }
+
   charset(const std::string& s) {
-    for (auto c : s) {
-      bitmap[c >> 6] |= 1 << (c & 0x3F);
+    for (uint8_t c : s) {
+      bitmap[c >> 6] |= uint64_t{1} << (c & 0x3F);
     }
   }
 
@@ -60,6 +122,8 @@ public:
     return cs;
   }
 
+  const std::array<uint64_t, 4>& bits() const { return bitmap; }
+
 private:
   std::array<uint64_t, 4> bitmap = {0,};
 
@@ -1,14 +1,38 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <functional>
+#include <iterator>
 #include "charset.h"
+#include "scan.h"
+#include "trie.h"
+#include "profile.h"
+#include "diagnostics.h"
 #include <tuple>
+#include <vector>
+#include <cassert>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <typeinfo>
 
-// TODO: add cut operator: parser1 cut parser2 - if parser1 succeeds then if parser2 fails, no backtracking occurs, fail whole hier. of parsers up to toplevel parser w/o context
-//                         (it may be done via throw)
-//       add max operator (like choice but selects max matched parser)
-//       change sematics of << operator (should move pos)
+// Lifetime checks of string_view converters are on in debug builds,
+// define COMB_PARSER_CHECK_VIEWS to 0 or 1 to override
+#ifndef COMB_PARSER_CHECK_VIEWS
+#ifdef NDEBUG
+#define COMB_PARSER_CHECK_VIEWS 0
+#else
+#define COMB_PARSER_CHECK_VIEWS 1
+#endif
+#endif
+
+// TODO: change sematics of << operator (should move pos)
 //       add ** operator with semantics of current <<
 
 namespace comb_parser {
@@ -20,6 +44,81 @@ using result = std::function<void(void)>;
 const result success{[]{}};
 const result fail;
 
+namespace detail {
+
+// Cut state of current thread: 'parser1 > parser2' sets cut when parser2 fails inside of cut_scope,
+// choices, optionals and repeats do not try other alternatives while cut is set,
+// cut_scope clears it on exit
+struct cut_state {
+  unsigned scopes = 0;
+  bool cut = false;
+};
+
+inline cut_state& cuts() {
+  thread_local cut_state s;
+  return s;
+}
+
+// result of parsers without effects, it need not be stored
+inline bool is_success(const result& r) { return r.target_type() == success.target_type(); }
+
+// parsing goes back from pos to start (sequence failed after its first part), it is counted
+// for running rule with COMB_PARSER_PROFILE (see profile.h), otherwise it costs nothing
+template<typename Iter>
+inline void backtracked(const Iter& start, const Iter& pos) {
+#ifdef COMB_PARSER_PROFILE
+  bool moved;
+  using category = typename std::iterator_traits<Iter>::iterator_category;
+  if constexpr (std::is_base_of_v<std::random_access_iterator_tag, category>) moved = pos - start != 0;
+  else moved = !(start == pos);
+  if (moved) profile::detail::note_backtrack();
+#else
+  (void)start; (void)pos;
+#endif
+}
+
+// effects of two results in sequence, without closure if one of them has no effects
+inline result sequenced(result r1, result r2) {
+  if (is_success(r2)) return r1;
+  if (is_success(r1)) return r2;
+  return [r1 = std::move(r1), r2 = std::move(r2)]{ r1(); r2(); };
+}
+
+// effects of several results as one result
+inline result joined(std::vector<result>&& results) {
+  if (results.empty()) return success;
+  if (results.size() == 1) return std::move(results[0]);
+  return [results = std::move(results)]{
+    for (auto& r: results) r();
+  };
+}
+
+// charset parser, it is named type so that repeat may recognize it
+template<typename Char, typename Iter, typename ...Args>
+struct charset_fn {
+  scan::table t;
+
+  // end of chars from set, byte chars are scanned with SIMD kernels
+  Iter span(Iter pos, Iter end) const {
+    if constexpr (sizeof(Char) == 1) {
+      return scan::skip(t, pos, end);
+    } else {
+      for (;pos != end && static_cast<std::make_unsigned_t<Char>>(*pos) < 256 && t.contains(*pos); ++pos) { }
+      return pos;
+    }
+  }
+
+  result operator()(Iter& pos, Iter end, Args...) const {
+    auto start = pos;
+    pos = span(pos, end);
+    if (pos != start) return success;
+    expected_set(pos, t.bits());
+    return fail;
+  }
+};
+
+} // namespace detail
+
 // Data converter result type
 
 template<typename T>
@@ -37,55 +136,125 @@ class converter;
 template<typename Char = char, typename Iter = const char*, typename ...Args>
 class parser;
 
+namespace st {
+// static parsers, see static_parser.h
+template<typename Derived>
+class base;
+}
+
+namespace utf8 {
+// code-point charset, see utf8.h
+class charset;
+}
+
 template<typename Char, typename Iter, typename ...Args>
 class base_parser : public std::function<result(Iter& pos, Iter end, Args...)> {
 public:
     using parserFn = std::function<result(Iter& pos, Iter end, Args...)>;
 
 private:
-    const parserFn parser_fn;
+    // parsers are nodes of shared graph: copy of parser (e.g. capture by combinator)
+    // shares its function, subtrees are never copied
+    std::shared_ptr<const parserFn> parser_fn;
+
+    static std::shared_ptr<const parserFn> node(parserFn f) { return std::make_shared<const parserFn>(std::move(f)); }
 
 public:
     template<typename Ctx>
     using with_context = parser<Char, Iter, Ctx, Args...>;
 
-    explicit base_parser(const parserFn& p) : parser_fn(p) { }
-    explicit base_parser(parserFn&& p) : parser_fn(std::move(p)) { }
+    explicit base_parser(const parserFn& p) : parser_fn(node(p)) { }
+    explicit base_parser(parserFn&& p) : parser_fn(node(std::move(p))) { }
 
-    base_parser() : parser_fn([]{ return success; }) {}
+    base_parser() : parser_fn(node([](Iter&, Iter, Args...){ return success; })) {}
     base_parser(const base_parser&) = default;
 
     base_parser(std::function<bool(Char)> matcher)
-      : parser_fn([=](Iter& pos, Iter end, Args...){
+      : parser_fn(node([=](Iter& pos, Iter end, Args...){
           auto start = pos;
           for (;pos != end && matcher(*pos); ++pos) { }
-          return pos != start ? success : fail;
-        }) { }
+          if (pos != start) return success;
+          detail::expected_set(pos, {0, 0, 0, 0}); // predicate cannot tell what it expects
+          return fail;
+        })) { }
+
+    // charset parser for byte chars uses SIMD scanning kernels
+    base_parser(const charset::charset& cs)
+      : parser_fn(node(detail::charset_fn<Char, Iter, Args...>{scan::table{cs}})) { }
+
+    base_parser(const charset::static_charset& cs) : base_parser(charset::charset{cs}) { }
+
+    // code-point charset, template so that utf8.h is needed only when it is used
+    template<typename CS, typename = std::enable_if_t<std::is_same_v<CS, utf8::charset>>>
+    base_parser(const CS& cs)
+      : parser_fn(node([cs](Iter& pos, Iter end, Args...){
+          auto start = pos;
+          pos = cs.span(pos, end);
+          if (pos != start) return success;
+          detail::expected_set(pos, cs.ascii_bits());
+          return fail;
+        })) { }
 
     base_parser(Char c)
-      : parser_fn([=](Iter& pos, Iter end, Args...){
-          if (pos == end) return fail;
-          if (*pos == c) { ++pos; return success; }
+      : parser_fn(node([=](Iter& pos, Iter end, Args...){
+          if (pos != end && *pos == c) { ++pos; return success; }
+          detail::expected_char(pos, c);
           return fail;
-        }) { }
+        })) { }
 
     base_parser(const Char* arr)
-      : parser_fn([=](Iter& pos, Iter end, Args...){
+      : parser_fn(node([=](Iter& pos, Iter end, Args...){
           auto start = pos;
           auto it = arr;
           for (; *it != 0 && pos != end && *it == *pos; ++it, ++pos) { }
           if (*it == 0) { return success; }
+          detail::expected_char(pos, *it);
           pos = start;
           return fail;
-        }) { }
+        })) { }
+
+    // type-erasure boundary for static parsers
+    template<typename D>
+    base_parser(const st::base<D>& sp)
+      : parser_fn(node([s = static_cast<const D&>(sp)](Iter& pos, Iter end, Args...args){
+          return s(pos, end, args...);
+        })) { }
 
     result operator()(Iter& pos, Iter end, Args...args) const {
-      return parser_fn(pos, end, args...);
+      return (*parser_fn)(pos, end, args...);
     }
 
+    // function of parser if it is of type F, for specializations of combinators
+    template<typename F>
+    const F* fn_target() const { return parser_fn->template target<F>(); }
+
     static base_parser end() {
       return base_parser{[](Iter& pos, Iter const end, Args...){
-          return pos == end ? success : fail;
+          if (pos == end) return success;
+          detail::expected_end(pos);
+          return fail;
+      }};
+    }
+
+    // set of keywords, the longest of them is matched in one pass with trie
+    static base_parser keywords(const std::vector<std::basic_string<Char>>& words) {
+      return base_parser{[t = std::make_shared<const literal_trie<Char>>(words)](Iter& pos, Iter end, Args...){
+          if (t->match(pos, end) >= 0) return success;
+          detail::expected_set(pos, t->first_chars());
+          return fail;
+      }};
+    }
+
+    // same, but index of matched keyword in 'words' is passed to process (like with converters)
+    static base_parser keywords(const std::vector<std::basic_string<Char>>& words,
+                                std::function<result(std::size_t, Args...)> process) {
+      return base_parser{[t = std::make_shared<const literal_trie<Char>>(words), process](Iter& pos, Iter end, Args...args){
+          auto start = pos;
+          auto idx = t->match(pos, end);
+          if (idx < 0) { detail::expected_set(pos, t->first_chars()); return fail; }
+          auto r = process(static_cast<std::size_t>(idx), args...);
+          if (!r) pos = start;
+          return r;
       }};
     }
 
@@ -117,10 +286,26 @@ public:
     parser(const base& p) : base(p) {}
     
     parser(std::function<bool(Char)> f) : base(f) {};
+    parser(const charset::charset& cs) : base(cs) {};
+    parser(const charset::static_charset& cs) : base(cs) {};
+    template<typename CS, typename = std::enable_if_t<std::is_same_v<CS, utf8::charset>>>
+    parser(const CS& cs) : base(cs) {};
     parser(Char c) : base(c) {};
     parser(const Char* arr) : base(arr) {};
 
+    template<typename D>
+    parser(const st::base<D>& sp) : base(sp) {};
+
     static parser end() { return parser{base::end()}; }
+
+    static parser keywords(const std::vector<std::basic_string<Char>>& words) {
+      return parser{base::keywords(words)};
+    }
+
+    static parser keywords(const std::vector<std::basic_string<Char>>& words,
+                           std::function<result(std::size_t, Args...)> process) {
+      return parser{base::keywords(words, std::move(process))};
+    }
 };
 
 template<typename Char, typename Iter, typename Arg, typename ...Args>
@@ -135,15 +320,31 @@ public:
     parser(const base& p) : base(p) {};
 
     parser(std::function<bool(Char)> f) : base(f) {};
+    parser(const charset::charset& cs) : base(cs) {};
+    parser(const charset::static_charset& cs) : base(cs) {};
+    template<typename CS, typename = std::enable_if_t<std::is_same_v<CS, utf8::charset>>>
+    parser(const CS& cs) : base(cs) {};
     parser(Char c) : base(c) {};
     parser(const Char* arr) : base(arr) {};
 
+    template<typename D>
+    parser(const st::base<D>& sp) : base(sp) {};
+
     parser(const parser<Char, Iter, Args...> p)
       : base([=](Iter& pos, Iter end, Arg, Args... args){
           return p(pos, end, args...);
         }) { }
 
     static parser end() { return parser{base::end()}; }
+
+    static parser keywords(const std::vector<std::basic_string<Char>>& words) {
+      return parser{base::keywords(words)};
+    }
+
+    static parser keywords(const std::vector<std::basic_string<Char>>& words,
+                           std::function<result(std::size_t, Args...)> process) {
+      return parser{base::keywords(words, std::move(process))};
+    }
 };
 
 //========================
@@ -157,6 +358,7 @@ const parser<Char, Iter, Args...> operator~(const parser<Char, Iter, Args...> p)
   return parser<Char, Iter, Args...>{[=](Iter& pos, Iter end, Args...args)->result{
     auto r = p(pos, end, args...);
     if (r) return r;
+    if (detail::cuts().cut) return fail;
     return success;
   }};
 }
@@ -172,7 +374,8 @@ const parser<Char, Iter, Args...> operator%(const parser<Char, Iter, Args...> p,
     if (r) {
       auto new_pos = start;
       auto rp = process(new_pos, pos, args...);
-      if (rp) { return [=]{r();rp();}; }
+      if (rp) return detail::sequenced(std::move(r), std::move(rp));
+      detail::backtracked(start, pos);
       pos = start;
     }
     return fail;
@@ -185,6 +388,7 @@ const parser<Char, Iter, Args...> operator| (const parser<Char, Iter, Args...> p
     return parser<Char, Iter, Args...>{[=] (Iter& pos, Iter end, Args...args)->result{
       auto r = p1(pos, end, args...);
       if (r) return r;
+      if (detail::cuts().cut) return fail;
       return p2(pos, end, args...);
     }};
 }
@@ -198,8 +402,42 @@ const parser<Char, Iter, Args...> operator+ (const parser<Char, Iter, Args...> p
     auto r1 = p1(pos, end, args...);
     if (!r1) return fail;
     auto r2 = p2(pos, end, args...);
-    if (!r2) { pos = start; return fail;}
-    return [=]{r1();r2();};
+    if (!r2) { detail::backtracked(start, pos); pos = start; return fail;}
+    return detail::sequenced(std::move(r1), std::move(r2));
+  }};
+}
+
+// combinator 'cut': parser1 > parser2 - sequence, but once parser1 succeeded, alternatives are committed:
+// if parser2 fails, whole enclosing cut_scope fails, choices/optionals/repeats inside of it
+// do not try other alternatives. Outside of cut_scope it is the same as parser1 + parser2
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> operator> (const parser<Char, Iter, Args...> p1, const parser<Char, Iter, Args...> p2) {
+  return parser<Char, Iter, Args...>{[=] (Iter& pos, Iter end, Args...args)->result{
+    auto start = pos;
+    auto r1 = p1(pos, end, args...);
+    if (!r1) return fail;
+    auto r2 = p2(pos, end, args...);
+    if (!r2) {
+      detail::backtracked(start, pos);
+      pos = start;
+      auto& c = detail::cuts();
+      if (c.scopes) c.cut = true;
+      return fail;
+    }
+    return detail::sequenced(std::move(r1), std::move(r2));
+  }};
+}
+
+// combinator 'cut scope': cut_scope(parser) - bounds cuts made inside of parser, usually it is a rule
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> cut_scope(const parser<Char, Iter, Args...> p) {
+  return parser<Char, Iter, Args...>{[=] (Iter& pos, Iter end, Args...args)->result{
+    struct guard {
+      detail::cut_state& c;
+      guard(detail::cut_state& c) : c(c) { ++c.scopes; }
+      ~guard() { --c.scopes; c.cut = false; }
+    } g{detail::cuts()};
+    return p(pos, end, args...);
   }};
 }
 
@@ -211,7 +449,7 @@ const parser<Char, Iter, Args...> operator>> (const parser<Char, Iter, Args...>
     auto r1 = p1(pos, end, args...);
     if (!r1) return fail;
     auto r2 = p2(pos, end, args...);
-    if (!r2) { pos = start; return fail;}
+    if (!r2) { detail::backtracked(start, pos); pos = start; return fail;}
     return r2;
   }};
 }
@@ -226,7 +464,7 @@ const parser<Char, Iter, Args...> operator<< (const parser<Char, Iter, Args...>
     if (!r1) return fail;
     auto before_p2 = pos;
     auto r2 = p2(pos, end, args...);
-    if (!r2) { pos = start; return fail;}
+    if (!r2) { detail::backtracked(start, pos); pos = start; return fail;}
     pos = before_p2; // TODO: see upper TODO
     return r1;;
   }};
@@ -239,6 +477,7 @@ const parser<Char, Iter, Args...> operator!(parser<Char, Iter, Args...> p) {
     auto start = pos;
     auto r = p(pos, end, args...);
     if (r) { pos = start; return fail; }
+    detail::cuts().cut = false; // cuts do not leave lookahead
     return success;
   }};
 }
@@ -248,28 +487,57 @@ const parser<Char, Iter, Args...> operator!(parser<Char, Iter, Args...> p) {
 // alternatives: [from ... +inf) - exactly <from> or more
 //               [0..to] - exactly <to> or less, down to 0
 //               [from..to] - exactly <from> or more, but less or equal <to>
+// effects are stored only for iterations which have them, so effect-free repeats do not allocate;
+// exact count has its own loop, repeated charset is one span scan
 template<typename Char, typename Iter, typename...Args>
 const parser<Char, Iter, Args...> repeat(const parser<Char, Iter, Args...> p, int from_times=0, int to_times=-1) {
-  return parser<Char, Iter, Args...>{[=] (Iter& pos, Iter end, Args...args)->result{
+  using parser_type = parser<Char, Iter, Args...>;
+
+  if (auto cs = p.template fn_target<detail::charset_fn<Char, Iter, Args...>>(); cs && to_times != 0) {
+    // span is greedy: it matches once or never, so more than one time is never matched
+    if (from_times > 1) return parser_type{[](Iter&, Iter, Args...){ return fail; }};
+    return parser_type{[cs = *cs, optional = from_times == 0](Iter& pos, Iter end, Args...args)->result{
+      auto r = cs(pos, end, args...);
+      return r || !optional ? r : success;
+    }};
+  }
+
+  if (from_times == to_times) {
+    return parser_type{[=] (Iter& pos, Iter end, Args...args)->result{
+      auto start = pos;
+      std::vector<result> results;
+      for (int times = 0; times < to_times; ++times) {
+        auto r = p(pos, end, args...);
+        if (!r) { detail::backtracked(start, pos); pos = start; return fail; }
+        if (!detail::is_success(r)) results.push_back(std::move(r));
+      }
+      return detail::joined(std::move(results));
+    }};
+  }
+
+  return parser_type{[=] (Iter& pos, Iter end, Args...args)->result{
     int times = 0;
     auto start = pos;
-    std::vector<result*> results;
-    while(pos != end && (to_times == -1 || times <= to_times)) {
+    std::vector<result> results;
+    while (to_times == -1 || times < to_times) {
+      auto before = pos;
       auto r = p(pos, end, args...);
       if (!r) break;
       ++times;
-      results.push_back(new result{r});
-    }
-    if (times >= from_times && (to_times == -1 || times <= to_times)) {
-      return [=]{
-        for (auto res: results){
-          (*res)();
-          delete res;
+      if (pos == before) {
+        // p matched empty chunk, it will match it forever: the rest of minimum is matched the same way
+        for (; times < from_times; ++times) {
+          if (!detail::is_success(r)) results.push_back(r);
         }
-      };
+        if (!detail::is_success(r)) results.push_back(std::move(r));
+        break;
+      }
+      if (!detail::is_success(r)) results.push_back(std::move(r));
     }
+    if (detail::cuts().cut) { detail::backtracked(start, pos); pos = start; return fail; }
+    if (times >= from_times) return detail::joined(std::move(results));
+    detail::backtracked(start, pos);
     pos = start;
-    for (auto res: results) delete res;
     return fail;
   }};
 }
@@ -282,6 +550,25 @@ const parser<Char, Iter, Args...> somewhere(const parser<Char, Iter, Args...> p)
     while(pos != end) {
       auto r = p(pos, end, args...);
       if (r) { return r; }
+      if (detail::cuts().cut) break;
+      ++pos;
+    }
+    pos = start;
+    return fail;
+  });
+}
+
+// combinator 'somewhere' with hint: somewhere(parser, first) - parser may start only with chars from 'first' charset,
+// so positions between candidates are skipped by scanning kernel
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> somewhere(const parser<Char, Iter, Args...> p, const charset::charset& first) {
+  static_assert(sizeof(Char) == 1, "first chars hint is for byte parsers");
+  return parser<Char, Iter, Args...>([=, t = scan::table{first}](Iter& pos, Iter end, Args...args)->result{
+    auto start = pos;
+    while((pos = scan::find(t, pos, end)) != end) {
+      auto r = p(pos, end, args...);
+      if (r) { return r; }
+      if (detail::cuts().cut) break;
       ++pos;
     }
     pos = start;
@@ -289,6 +576,42 @@ const parser<Char, Iter, Args...> somewhere(const parser<Char, Iter, Args...> p)
   });
 }
 
+// combinator 'longest': longest(parser1, parser2, ...) - like choice, but all alternatives are tried
+// from the same position and the longest match wins (first one of equally long matches),
+// effects of other matches are just dropped; cuts do not leave alternatives.
+// Alternatives are opaque closures here, so each of them scans input from start on its own,
+// prefixes are not shared. For tokenizers pass literal alternatives as one p::keywords(...)
+// (one pass over trie), or use ast::longest, whose optimize() merges literals into literal_trie
+template<typename Char, typename Iter, typename...Args, typename...Ps>
+const parser<Char, Iter, Args...> longest(const parser<Char, Iter, Args...> p, const Ps... ps) {
+  const std::array<parser<Char, Iter, Args...>, 1 + sizeof...(Ps)> alternatives{p, parser<Char, Iter, Args...>{ps}...};
+  return parser<Char, Iter, Args...>{[=](Iter& pos, Iter end, Args...args)->result{
+    auto start = pos;
+    auto best_pos = start;
+    typename std::iterator_traits<Iter>::difference_type best_length = 0;
+    result best;
+    // alternatives are independent: cut made inside of one of them does not affect others
+    auto& cuts = detail::cuts();
+    const bool cut = cuts.cut;
+    for (auto& alt: alternatives) {
+      auto at = start;
+      cuts.cut = false;
+      auto r = alt(at, end, args...);
+      cuts.cut = false;
+      if (!r) continue;
+      auto length = std::distance(start, at);
+      if (!best || length > best_length) {
+        best = std::move(r);
+        best_pos = at;
+        best_length = length;
+      }
+    }
+    cuts.cut = cut;
+    if (best) pos = best_pos;
+    return best;
+  }};
+}
+
 template<typename L, typename Char, typename Iter, typename Arg, typename...Args>
 const parser<Char, Iter, Args...> operator*(const parser<Char, Iter, Arg, Args...> p, L context_gen) {
   return parser<Char, Iter, Args...>{[=](Iter& pos, Iter end, Args...args)->result{
@@ -296,6 +619,314 @@ const parser<Char, Iter, Args...> operator*(const parser<Char, Iter, Arg, Args..
   }};
 }
 
+//======================
+// Pooled lazy contexts
+
+// Context generator above runs on every attempt, and shared_ptr context is copied (atomic increment)
+// through every nested call. Instead, layer may use lazy_context<T>: it is one pointer to frame of
+// the attempt, frames are taken from per-thread pool, and T is constructed on first access only,
+// so attempts, which fail before touching context, do not create it:
+//
+//   using pc = up::with_context<cp::lazy_context<param_s>>;
+//   const up param = param_pair * cp::context_pool<param_s>{};
+//
+// Frame goes back to the pool when attempt fails or has no effects, otherwise effects own it
+// and it goes back when last copy of effects is destroyed. If effects are destroyed by other
+// thread (e.g. parse_batch), frame is returned to pool of thread, which allocated it.
+
+template<typename T>
+class context_pool;
+
+namespace detail {
+
+template<typename T>
+struct context_frames;
+
+template<typename T>
+struct context_frame {
+  std::optional<T> value;
+  std::atomic<std::size_t> owners{0};  // copies of effects holding frame
+  context_frames<T>* home = nullptr;   // pool of thread, which allocated frame
+  context_frame* next = nullptr;
+};
+
+// frames of one thread: free list is used by the thread only, frames released by other threads
+// are put into returned list, which is taken when free list is empty.
+// Pool outlives its thread while some of its frames are still in use.
+template<typename T>
+struct context_frames {
+  context_frame<T>* free = nullptr;
+  std::size_t allocated = 0;
+  std::size_t outstanding = 0;          // frames out of free list
+
+  std::mutex m;
+  context_frame<T>* returned = nullptr; // guarded by m
+  bool orphaned = false;                // guarded by m, thread has exited
+};
+
+} // namespace detail
+
+template<typename T>
+class lazy_context {
+public:
+  explicit lazy_context(detail::context_frame<T>* f) : frame(f) { }
+
+  T& operator*() const {
+    if (!frame->value) frame->value.emplace();
+    return *frame->value;
+  }
+  T* operator->() const { return &**this; }
+
+  bool created() const { return frame->value.has_value(); }
+
+private:
+  detail::context_frame<T>* frame;
+};
+
+template<typename T>
+class context_pool {
+public:
+  using frame = detail::context_frame<T>;
+
+  static frame* acquire() {
+    auto l = frames();
+    if (!l->free) take_returned(*l);
+    frame* f = l->free;
+    if (f) {
+      l->free = f->next;
+    } else {
+      f = new frame;
+      f->home = l;
+      ++l->allocated;
+    }
+    ++l->outstanding;
+    return f;
+  }
+
+  static void release(frame* f) {
+    f->value.reset();
+    auto l = f->home;
+    if (l == frames()) {
+      f->next = l->free;
+      l->free = f;
+      --l->outstanding;
+      return;
+    }
+    bool last = false;
+    {
+      std::lock_guard<std::mutex> lock(l->m);
+      if (!l->orphaned) {
+        f->next = l->returned;
+        l->returned = f;
+        return;
+      }
+      delete f;
+      last = --l->outstanding == 0;
+    }
+    if (last) delete l;
+  }
+
+  // frames ever allocated by current thread
+  static std::size_t allocated() { return frames()->allocated; }
+
+private:
+  using pool = detail::context_frames<T>;
+
+  static void take_returned(pool& l) {
+    std::lock_guard<std::mutex> lock(l.m);
+    while (l.returned) {
+      auto f = std::exchange(l.returned, l.returned->next);
+      f->next = l.free;
+      l.free = f;
+      --l.outstanding;
+    }
+  }
+
+  struct thread_frames {
+    pool* l = new pool;
+    ~thread_frames() {
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(l->m);
+        while (l->free) delete std::exchange(l->free, l->free->next);
+        while (l->returned) {
+          delete std::exchange(l->returned, l->returned->next);
+          --l->outstanding;
+        }
+        l->orphaned = true;
+        last = l->outstanding == 0;
+      }
+      if (last) delete l;
+    }
+  };
+
+  static pool* frames() {
+    thread_local thread_frames t;
+    return t.l;
+  }
+};
+
+namespace detail {
+
+// effects of attempt, which used pooled context frame
+template<typename T>
+struct frame_owner {
+  context_frame<T>* frame;
+  result r;
+
+  frame_owner(context_frame<T>* f, result r) : frame(f), r(std::move(r)) {
+    frame->owners.fetch_add(1, std::memory_order_relaxed);
+  }
+  frame_owner(const frame_owner& o) : frame(o.frame), r(o.r) {
+    frame->owners.fetch_add(1, std::memory_order_relaxed);
+  }
+  frame_owner& operator=(const frame_owner&) = delete;
+  ~frame_owner() {
+    if (frame->owners.fetch_sub(1, std::memory_order_acq_rel) == 1) context_pool<T>::release(frame);
+  }
+
+  void operator()() const { r(); }
+};
+
+} // namespace detail
+
+template<typename T, typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> operator*(const parser<Char, Iter, lazy_context<T>, Args...> p, context_pool<T>) {
+  return parser<Char, Iter, Args...>{[=](Iter& pos, Iter end, Args...args)->result{
+    auto f = context_pool<T>::acquire();
+    auto r = p(pos, end, lazy_context<T>{f}, args...);
+    if (!r || detail::is_success(r)) {
+      context_pool<T>::release(f);
+      return r;
+    }
+    return detail::frame_owner<T>{f, std::move(r)};
+  }};
+}
+
+//======================
+// Named rules
+
+#ifdef COMB_PARSER_PROFILE
+namespace detail {
+
+// results are passed through as they are, so profiled rules allocate as plain ones
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> instrument(profile::rule_stats& s, const parser<Char, Iter, Args...> p) {
+  return parser<Char, Iter, Args...>{[stats = &s, p](Iter& pos, Iter end, Args...args)->result{
+    auto h = profile::detail::current_hook().load(std::memory_order_acquire);
+    if (h) h->on_enter(*stats);
+    auto start = pos;
+    auto& current = profile::detail::current_rule();
+    auto outer = std::exchange(current, stats);
+    auto t0 = profile::detail::now_ns();
+    auto r = p(pos, end, args...);
+    auto ns = profile::detail::now_ns() - t0;
+    current = outer;
+    std::size_t consumed = 0;
+    stats->calls.fetch_add(1, std::memory_order_relaxed);
+    stats->nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+    if (r) {
+      consumed = std::distance(start, pos);
+      stats->successes.fetch_add(1, std::memory_order_relaxed);
+      stats->bytes.fetch_add(consumed, std::memory_order_relaxed);
+      if (!is_success(r)) stats->effects.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      stats->failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (h) h->on_exit(*stats, static_cast<bool>(r), consumed, ns);
+    return r;
+  }};
+}
+
+} // namespace detail
+#endif
+
+#ifdef COMB_PARSER_DIAGNOSTICS
+namespace detail {
+
+// failed rule is reported to diagnostics at position, where it started
+template<typename Char, typename Iter, typename...Args>
+const parser<Char, Iter, Args...> report_rule(std::size_t id, const parser<Char, Iter, Args...> p) {
+  return parser<Char, Iter, Args...>{[id, p](Iter& pos, Iter end, Args...args)->result{
+    auto start = pos;
+    auto r = p(pos, end, args...);
+    if (!r) expected_rule(start, id);
+    return r;
+  }};
+}
+
+} // namespace detail
+#endif
+
+// Named rule: rule("path", path) is the same parser as 'path'.
+// With COMB_PARSER_PROFILE defined rule also collects statistics (see profile.h),
+// with COMB_PARSER_DIAGNOSTICS defined failed rule is reported to diagnostics (see diagnostics.h),
+// without them there is no extra cost at all.
+//
+// Rule may be declared before definition, so that rules may be recursive:
+//   rule<char, Iter> value{"value"};
+//   const p list = p{'('} + repeat(value) + p{')'};
+//   value = p{alpha} | list;
+// Such rule calls its definition through its handle, it should outlive parsers built from it
+// (after it is destroyed they fail). Assignment of other rule defines declared rule by it.
+template<typename Char, typename Iter, typename ...Args>
+class rule : public parser<Char, Iter, Args...> {
+    using base = parser<Char, Iter, Args...>;
+public:
+    rule(std::string name, const base& p) : base(instrument(name, p)), rule_name(std::move(name)) { }
+
+    // declaration, rule fails until it is defined
+    explicit rule(std::string name) : rule(std::move(name), std::make_shared<slot>()) { }
+
+    // definition of declared rule, defined rule cannot be changed (std::logic_error)
+    rule& operator=(const base& p) {
+      if (!definition) throw std::logic_error("rule '" + rule_name + "' is not declared, it cannot be redefined");
+      definition->p = instrument(rule_name, p);
+      return *this;
+    }
+
+    rule(const rule&) = default;
+    rule(rule&&) = default;
+
+    // parsers built from declared rule keep calling its slot, so it is never replaced
+    rule& operator=(const rule& r) { return *this = static_cast<const base&>(r); }
+    rule& operator=(rule&& r) { return *this = static_cast<const base&>(r); }
+
+    const std::string& name() const { return rule_name; }
+
+private:
+    struct slot {
+      base p{typename base::parserFn{[](Iter&, Iter, Args...){ return fail; }}};
+    };
+
+    std::shared_ptr<slot> definition;
+    std::string rule_name;
+
+    rule(std::string name, std::shared_ptr<slot> s)
+      : base(typename base::parserFn{[d = std::weak_ptr<slot>(s)](Iter& pos, Iter end, Args...args)->result{
+          // weak reference: recursive rule would own itself otherwise
+          auto sp = d.lock();
+          if (!sp) return fail;
+          return sp->p(pos, end, args...);
+        }}),
+        definition(std::move(s)), rule_name(std::move(name)) { }
+
+    static base instrument(const std::string& name, const base& p) {
+      (void)name;
+      base r = p;
+#ifdef COMB_PARSER_DIAGNOSTICS
+      r = detail::report_rule(detail::rule_names::add(name), r);
+#endif
+#ifdef COMB_PARSER_PROFILE
+      r = detail::instrument(profile::register_rule(name), r);
+#endif
+      return r;
+    }
+};
+
+template<typename Char, typename Iter, typename ...Args>
+rule(std::string, parser<Char, Iter, Args...>) -> rule<Char, Iter, Args...>;
+
 //======================
 // Converter definition
 
@@ -320,5 +951,134 @@ public:
 
 };
 
+//======================
+// Zero-copy converters, make converter for parser with:
+//   p::make_converter<std::string_view>(view_conv)
+//   p::make_converter<int>(number_conv<int>)
+//   p::make_converter<iter_range<Iter>>(range_conv)
+// they do not copy matched chunk. Results of pointer-sized iterators fit into small buffer
+// of std::function, so they do not allocate, but only with COMB_PARSER_CHECK_VIEWS off (release
+// builds): checked view holds token of its buffer too, it allocates and locks guard registry
+// on every conversion.
+
+// Guard of input buffer lifetime for checked views. When COMB_PARSER_CHECK_VIEWS is on,
+// view converter asserts that guarded buffer is still alive when conversion result is used.
+class input_guard {
+public:
+  input_guard(const char* begin, const char* end) : token(std::make_shared<char>()) {
+#if COMB_PARSER_CHECK_VIEWS
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    registry().push_back({begin, end, token});
+#else
+    (void)begin; (void)end;
+#endif
+  }
+
+  template<typename C>
+  explicit input_guard(const C& c) : input_guard(c.data(), c.data() + c.size()) { }
+
+  input_guard(const input_guard&) = delete;
+  input_guard& operator=(const input_guard&) = delete;
+
+  ~input_guard() {
+#if COMB_PARSER_CHECK_VIEWS
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto& r = registry();
+    for (auto it = r.begin(); it != r.end(); ++it) {
+      if (it->token == token) { r.erase(it); break; }
+    }
+#endif
+  }
+
+  // token of guarded buffer which contains p, empty if buffer is not guarded
+  static std::weak_ptr<char> find(const char* p) {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    for (auto& e: registry()) {
+      if (p >= e.begin && p <= e.end) return e.token;
+    }
+    return {};
+  }
+
+private:
+  struct entry {
+    const char* begin;
+    const char* end;
+    std::shared_ptr<char> token;
+  };
+
+  std::shared_ptr<char> token;
+
+  static std::vector<entry>& registry() { static std::vector<entry> r; return r; }
+  static std::mutex& registry_mutex() { static std::mutex m; return m; }
+};
+
+// pair of iterators, for inputs which are not contiguous
+template<typename Iter>
+struct iter_range {
+  Iter begin;
+  Iter end;
+};
+
+namespace detail {
+
+template<typename Iter>
+const char* data_of(Iter pos, Iter end) {
+  static_assert(scan::is_contiguous_bytes<Iter>::value, "string_view may be made only for contiguous input, use range_conv");
+  return pos == end ? nullptr : reinterpret_cast<const char*>(&*pos);
+}
+
+} // namespace detail
+
+const auto view_conv = [](auto pos, auto end) -> converter_result<std::string_view>::type {
+  std::string_view v{detail::data_of(pos, end), static_cast<std::size_t>(end - pos)};
+#if COMB_PARSER_CHECK_VIEWS
+  if (auto token = input_guard::find(v.data()); !token.expired()) {
+    return [=]{
+      assert(!token.expired() && "string_view into destroyed input");
+      return v;
+    };
+  }
+#endif
+  return [=]{ return v; };
+};
+
+const auto range_conv = [](auto pos, auto end) -> typename converter_result<iter_range<decltype(pos)>>::type {
+  return [=]{ return iter_range<decltype(pos)>{pos, end}; };
+};
+
+namespace detail {
+
+// matched chunk as number with std::from_chars, chunk should be number as whole
+template<typename T, typename Iter>
+bool from_chars(Iter pos, Iter end, T& value) {
+  std::from_chars_result r;
+  const char* last;
+  if constexpr (scan::is_contiguous_bytes<Iter>::value) {
+    auto first = data_of(pos, end);
+    last = first + (end - pos);
+    r = std::from_chars(first, last, value);
+  } else {
+    char buf[64];
+    std::size_t n = 0;
+    for (; pos != end; ++pos) {
+      if (n == sizeof(buf)) return false;
+      buf[n++] = *pos;
+    }
+    last = buf + n;
+    r = std::from_chars(buf, last, value);
+  }
+  return r.ec == std::errc{} && r.ptr == last;
+}
+
+} // namespace detail
+
+// number converter based on std::from_chars, matched chunk should be number as whole
+template<typename T>
+const auto number_conv = [](auto pos, auto end) -> typename converter_result<T>::type {
+  T value{};
+  if (!detail::from_chars(pos, end, value)) return converter_result<T>::fail;
+  return [=]{ return value; };
+};
+
 
 }
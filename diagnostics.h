@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "charset.h"
+
+// Diagnostics of failed parses: farthest failure position and what was expected there.
+//
+// Leaf parsers report their failures to diagnostics, which is active in current thread,
+// if there is no active one the report is a single thread-local load on failure path.
+// Diagnostics keeps only the farthest position, union of expected chars (charset bitmap)
+// and bitset of ids of rules, which failed there; strings are built only by message().
+//
+//   cp::diagnostics<const char*> diag{input.data()};
+//   {
+//     auto active = diag.activate();
+//     r = grammar(pos, end);
+//   }
+//   if (!r) std::cerr << diag.message() << std::endl; // offset 7: expected one of '0'-'9' or rule 'port'
+//
+// Rule names are reported by rules (see rule in comb_parser.h) when COMB_PARSER_DIAGNOSTICS is defined.
+// Compiled grammar trees (ast.h) and bytecode programs (vm.h) report the same way, alternatives
+// skipped by FIRST sets report their FIRST chars. Expected chars are bytes: code points of char32_t
+// parsers above U+00FF are reported only as failure position.
+
+namespace comb_parser {
+
+template<typename Iter>
+class diagnostics;
+
+namespace detail {
+
+template<typename Iter>
+diagnostics<Iter>*& active_diagnostics() {
+  thread_local diagnostics<Iter>* d = nullptr;
+  return d;
+}
+
+// names of rules by id
+class rule_names {
+public:
+  static std::size_t add(const std::string& name) {
+    auto& r = get();
+    std::lock_guard<std::mutex> lock(r.m);
+    r.names.push_back(name);
+    return r.names.size() - 1;
+  }
+
+  static std::string name(std::size_t id) {
+    auto& r = get();
+    std::lock_guard<std::mutex> lock(r.m);
+    return id < r.names.size() ? r.names[id] : std::string{};
+  }
+
+private:
+  std::mutex m;
+  std::deque<std::string> names;
+
+  static rule_names& get() {
+    static rule_names r;
+    return r;
+  }
+};
+
+} // namespace detail
+
+template<typename Iter>
+class diagnostics {
+public:
+  // positions are reported as offsets from begin (in chars of Iter)
+  explicit diagnostics(Iter begin) : begin(begin) { }
+
+  diagnostics(const diagnostics&) = delete;
+  diagnostics& operator=(const diagnostics&) = delete;
+
+  // makes diagnostics active in current thread, while scope is alive
+  class scope {
+  public:
+    explicit scope(diagnostics& d) : prev(detail::active_diagnostics<Iter>()) { detail::active_diagnostics<Iter>() = &d; }
+    ~scope() { detail::active_diagnostics<Iter>() = prev; }
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+  private:
+    diagnostics* prev;
+  };
+
+  scope activate() { return scope{*this}; }
+
+  //=====================
+  // reports of parsers
+
+  void expect_char(Iter pos, uint8_t c) {
+    if (!at(pos)) return;
+    bits[c >> 6] |= uint64_t{1} << (c & 0x3F);
+  }
+
+  void expect_set(Iter pos, const std::array<uint64_t, 4>& cs) {
+    if (!at(pos)) return;
+    for (int i = 0; i < 4; ++i) bits[i] |= cs[i];
+  }
+
+  void expect_end(Iter pos) {
+    if (at(pos)) end_expected = true;
+  }
+
+  void expect_rule(Iter pos, std::size_t id) {
+    if (!at(pos)) return;
+    if (rules.size() <= id / 64) rules.resize(id / 64 + 1);
+    rules[id / 64] |= uint64_t{1} << (id % 64);
+  }
+
+  //=====================
+  // results
+
+  bool failed() const { return reported; }
+  std::size_t offset() const { return farthest; }
+  Iter position() const { return std::next(begin, farthest); }
+
+  charset::charset expected_chars() const {
+    return charset::charset{std::function<bool(uint8_t)>{[this](uint8_t c){
+      return (bits[c >> 6] & (uint64_t{1} << (c & 0x3F))) != 0;
+    }}};
+  }
+
+  bool expected_end() const { return end_expected; }
+
+  std::vector<std::size_t> expected_rules() const {
+    std::vector<std::size_t> ids;
+    for (std::size_t w = 0; w < rules.size(); ++w) {
+      for (std::size_t b = 0; b < 64; ++b) if (rules[w] & (uint64_t{1} << b)) ids.push_back(w * 64 + b);
+    }
+    return ids;
+  }
+
+  // e.g. "offset 7: expected one of '0'-'9', ':' or rule 'port'"
+  std::string message() const {
+    if (!reported) return "no failure";
+    std::vector<std::string> items;
+    for (int c = 0; c < 256; ++c) {
+      if (!has(c)) continue;
+      int last = c;
+      while (last + 1 < 256 && has(last + 1)) ++last;
+      items.push_back(last >= c + 2 ? quote(c) + "-" + quote(last) : quote(c));
+      if (last == c + 1) items.push_back(quote(last));
+      c = last;
+    }
+    if (end_expected) items.push_back("end of input");
+    for (auto id: expected_rules()) items.push_back("rule '" + detail::rule_names::name(id) + "'");
+
+    std::string m = "offset " + std::to_string(farthest) + ": ";
+    if (items.empty()) return m + "unexpected input";
+    m += items.size() == 1 ? "expected " : "expected one of ";
+    for (std::size_t i = 0; i < items.size(); ++i) {
+      if (i) m += i + 1 == items.size() ? " or " : ", ";
+      m += items[i];
+    }
+    return m;
+  }
+
+  void clear() {
+    reported = false;
+    farthest = 0;
+    reset_expected();
+  }
+
+private:
+  Iter begin;
+  std::size_t farthest = 0;
+  bool reported = false;
+  bool end_expected = false;
+  uint64_t bits[4] = {0, 0, 0, 0};
+  std::vector<uint64_t> rules;
+
+  // true if pos is farthest failure position, farther position resets expected set
+  bool at(Iter pos) {
+    std::size_t off = std::distance(begin, pos); // linear for non-random-access iterators
+    if (reported && off < farthest) return false;
+    if (!reported || off > farthest) {
+      reported = true;
+      farthest = off;
+      reset_expected();
+    }
+    return true;
+  }
+
+  void reset_expected() {
+    end_expected = false;
+    for (auto& b: bits) b = 0;
+    for (auto& r: rules) r = 0;
+  }
+
+  bool has(int c) const { return (bits[c >> 6] & (uint64_t{1} << (c & 0x3F))) != 0; }
+
+  static std::string quote(int c) {
+    if (c >= 0x20 && c < 0x7F && c != '\'') return std::string{'\'', static_cast<char>(c), '\''};
+    static const char hex[] = "0123456789abcdef";
+    return std::string{"'\\x"} + hex[c >> 4] + hex[c & 0xF] + "'";
+  }
+};
+
+namespace detail {
+
+// reports of leaf parsers, nothing but thread-local load if diagnostics is not active
+
+// chars out of byte range (code points of char32_t parsers) are not in expected set,
+// only failure position is reported for them
+template<typename Iter, typename C>
+inline void expected_char(Iter pos, C c) {
+  if (auto d = active_diagnostics<Iter>()) {
+    auto u = static_cast<std::make_unsigned_t<C>>(c);
+    if (u < 256) d->expect_char(pos, static_cast<uint8_t>(u));
+    else d->expect_set(pos, {0, 0, 0, 0});
+  }
+}
+
+// literal, which does not match at pos, is reported at its first char, which does not match
+template<typename Iter, typename Char>
+inline void expected_literal(Iter pos, Iter end, const std::basic_string<Char>& text) {
+  if (!active_diagnostics<Iter>()) return;
+  for (auto c: text) {
+    if (pos == end || *pos != c) { expected_char(pos, c); return; }
+    ++pos;
+  }
+}
+
+template<typename Iter>
+inline void expected_set(Iter pos, const std::array<uint64_t, 4>& cs) {
+  if (auto d = active_diagnostics<Iter>()) d->expect_set(pos, cs);
+}
+
+template<typename Iter>
+inline void expected_end(Iter pos) {
+  if (auto d = active_diagnostics<Iter>()) d->expect_end(pos);
+}
+
+template<typename Iter>
+inline void expected_rule(Iter pos, std::size_t id) {
+  if (auto d = active_diagnostics<Iter>()) d->expect_rule(pos, id);
+}
+
+} // namespace detail
+
+} // namespace comb_parser
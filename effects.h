@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Arena-allocated log of effects.
+//
+// Effects are appended to flat log during parsing, on backtracking log is rolled back
+// to a mark, and after successful parse effects are applied in order of recording.
+// Effect objects (usually lambdas) are placed into chunks of arena, chunks are not freed
+// on rollback or clear, so parser which reuses log does not call malloc/free on hot path.
+// Chunks and entries are allocated from memory resource (default one by default), so log
+// of one request may live in monotonic buffer, which is released at once.
+
+namespace comb_parser {
+
+class effect_log {
+public:
+  struct mark_type {
+    std::size_t entry;
+    std::size_t chunk;
+    std::size_t offset;
+  };
+
+  explicit effect_log(std::size_t chunk_size = 4096)
+    : effect_log(std::pmr::get_default_resource(), chunk_size) { }
+
+  explicit effect_log(std::pmr::memory_resource* resource, std::size_t chunk_size = 4096)
+    : res(resource), chunk_size(chunk_size) { }
+
+  effect_log(effect_log&& other) : res(other.res), chunk_size(other.chunk_size) { swap(other); }
+
+  effect_log& operator=(effect_log&& other) {
+    clear();
+    swap(other);
+    return *this;
+  }
+
+  effect_log(const effect_log&) = delete;
+  effect_log& operator=(const effect_log&) = delete;
+
+  ~effect_log() {
+    clear();
+    for (std::size_t i = 0; i < chunk_count; ++i) res->deallocate(chunks[i].data, chunks[i].size, alignof(std::max_align_t));
+    release(chunks, chunk_capacity);
+    release(entries, entry_capacity);
+  }
+
+  std::pmr::memory_resource* resource() const { return res; }
+
+  mark_type mark() const { return {entry_count, current, offset}; }
+
+  // destroy all effects recorded after mark, their memory is reused
+  void rollback(mark_type m) {
+    destroy_from(m.entry);
+    current = m.chunk;
+    offset = m.offset;
+  }
+
+  template<typename F>
+  void push(F&& f) {
+    using T = std::decay_t<F>;
+    void* obj = allocate(sizeof(T), alignof(T));
+    new (obj) T(std::forward<F>(f));
+    grow(entries, entry_count, entry_capacity);
+    entries[entry_count++] = entry{obj,
+                                   [](void* o){ (*static_cast<T*>(o))(); },
+                                   std::is_trivially_destructible_v<T> ? nullptr : +[](void* o){ static_cast<T*>(o)->~T(); }};
+  }
+
+  bool empty() const { return entry_count == 0; }
+  std::size_t size() const { return entry_count; }
+
+  // apply effects in order of recording
+  void apply() const {
+    for (std::size_t i = 0; i < entry_count; ++i) entries[i].call(entries[i].obj);
+  }
+
+  // drop all effects, but keep memory for next parse
+  void clear() { rollback({0, 0, 0}); }
+
+  // memory of logs is swapped too, so resources may differ
+  void swap(effect_log& other) {
+    std::swap(res, other.res);
+    std::swap(entries, other.entries);
+    std::swap(entry_count, other.entry_count);
+    std::swap(entry_capacity, other.entry_capacity);
+    std::swap(chunks, other.chunks);
+    std::swap(chunk_count, other.chunk_count);
+    std::swap(chunk_capacity, other.chunk_capacity);
+    std::swap(chunk_size, other.chunk_size);
+    std::swap(current, other.current);
+    std::swap(offset, other.offset);
+  }
+
+private:
+  struct entry {
+    void* obj;
+    void (*call)(void*);
+    void (*destroy)(void*);
+  };
+
+  struct chunk {
+    std::byte* data;
+    std::size_t size;
+  };
+
+  // arrays of trivial structs, managed by hand, so that they are allocated from resource
+  // and may be swapped between logs with different resources
+  std::pmr::memory_resource* res;
+  entry* entries = nullptr;
+  std::size_t entry_count = 0;
+  std::size_t entry_capacity = 0;
+  chunk* chunks = nullptr;
+  std::size_t chunk_count = 0;
+  std::size_t chunk_capacity = 0;
+  std::size_t chunk_size;
+  std::size_t current = 0; // index of chunk to allocate from
+  std::size_t offset = 0;  // offset in current chunk
+
+  template<typename T>
+  void grow(T*& data, std::size_t count, std::size_t& capacity) {
+    if (count < capacity) return;
+    auto new_capacity = capacity ? capacity * 2 : 16;
+    auto p = static_cast<T*>(res->allocate(new_capacity * sizeof(T), alignof(T)));
+    std::copy(data, data + count, p);
+    release(data, capacity);
+    data = p;
+    capacity = new_capacity;
+  }
+
+  template<typename T>
+  void release(T*& data, std::size_t& capacity) {
+    if (data) res->deallocate(data, capacity * sizeof(T), alignof(T));
+    data = nullptr;
+    capacity = 0;
+  }
+
+  void destroy_from(std::size_t idx) {
+    for (auto i = entry_count; i > idx; --i) {
+      auto& e = entries[i - 1];
+      if (e.destroy) e.destroy(e.obj);
+    }
+    entry_count = idx;
+  }
+
+  void* allocate(std::size_t size, std::size_t align) {
+    for (;; ++current, offset = 0) {
+      if (current == chunk_count) {
+        auto sz = size + align > chunk_size ? size + align : chunk_size;
+        grow(chunks, chunk_count, chunk_capacity);
+        chunks[chunk_count++] = chunk{static_cast<std::byte*>(res->allocate(sz, alignof(std::max_align_t))), sz};
+      }
+      auto& c = chunks[current];
+      auto addr = reinterpret_cast<std::uintptr_t>(c.data) + offset;
+      auto aligned = (addr + align - 1) & ~(std::uintptr_t)(align - 1);
+      auto next = aligned - reinterpret_cast<std::uintptr_t>(c.data) + size;
+      if (next <= c.size) {
+        offset = next;
+        return reinterpret_cast<void*>(aligned);
+      }
+    }
+  }
+};
+
+} // namespace comb_parser
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Memory-mapped input files.
+//
+// File is mapped read-only, its iterators are plain const char*, the default Iter of parsers,
+// so every combinator (and SIMD scanning) works on it without copying the file.
+
+namespace comb_parser {
+
+class mapped_file {
+public:
+  // huge_pages: ask kernel to back mapping with transparent huge pages, where available
+  explicit mapped_file(const std::string& path, bool huge_pages = false) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "fstat " + path);
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    if (length > 0) {
+      void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap " + path);
+      }
+      mapping = static_cast<const char*>(addr);
+      // hints only, errors are ignored
+      ::madvise(addr, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+      if (huge_pages) ::madvise(addr, length, MADV_HUGEPAGE);
+#else
+      (void)huge_pages;
+#endif
+    }
+    ::close(fd);
+  }
+
+  mapped_file(mapped_file&& other) noexcept
+    : mapping(std::exchange(other.mapping, nullptr)), length(std::exchange(other.length, 0)) { }
+
+  mapped_file& operator=(mapped_file&& other) noexcept {
+    std::swap(mapping, other.mapping);
+    std::swap(length, other.length);
+    return *this;
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() {
+    if (mapping) ::munmap(const_cast<char*>(mapping), length);
+  }
+
+  const char* data() const { return mapping; }
+  const char* begin() const { return mapping; }
+  const char* end() const { return mapping + length; }
+  std::size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+
+private:
+  const char* mapping = nullptr;
+  std::size_t length = 0;
+};
+
+struct parse_file_result {
+  bool matched;
+  std::size_t consumed; // number of bytes matched by grammar
+};
+
+// Maps file, parses it with grammar and applies effects while file is still mapped,
+// so effects may use string_views into file.
+template<typename Grammar, typename ...Args>
+parse_file_result parse_file(const std::string& path, const Grammar& grammar, Args...args) {
+  mapped_file file{path};
+  const char* pos = file.begin();
+  auto r = grammar(pos, file.end(), args...);
+  if (!r) return {false, 0};
+  r();
+  return {true, static_cast<std::size_t>(pos - file.begin())};
+}
+
+} // namespace comb_parser
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Per-rule profiling.
+//
+// Rules are named parsers: rule("path", path). When COMB_PARSER_PROFILE is defined, every rule
+// records its statistics here and calls profile hook; otherwise rule is the very same parser,
+// so profiling costs nothing. Statistics of rule:
+//   calls, successes, failures  - invocations and their outcomes
+//   bytes                       - chars consumed by successful invocations
+//   backtracks                  - times parsing inside of rule went back: sequence (or repeat) failed
+//                                 after its first part had consumed input, counted where it happens
+//                                 for the innermost running rule
+//   effects                     - effect closures created (results other than 'success')
+//   nanoseconds                 - time spent in rule, including nested rules
+// Counters are atomic, so rules may be shared between threads.
+
+namespace comb_parser::profile {
+
+struct rule_stats {
+  explicit rule_stats(std::string name) : name(std::move(name)) { }
+
+  const std::string name;
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> successes{0};
+  std::atomic<uint64_t> failures{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> backtracked{0};
+  std::atomic<uint64_t> effects{0};
+  std::atomic<uint64_t> nanoseconds{0};
+
+  uint64_t backtracks() const { return backtracked.load(std::memory_order_relaxed); }
+
+  void reset() {
+    for (auto c: {&calls, &successes, &failures, &bytes, &backtracked, &effects, &nanoseconds}) {
+      c->store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// user metrics: hook is called around every invocation of instrumented rule
+class hook {
+public:
+  virtual ~hook() = default;
+  virtual void on_enter(const rule_stats&) { }
+  virtual void on_exit(const rule_stats&, bool matched, std::size_t consumed, uint64_t nanoseconds) {
+    (void)matched; (void)consumed; (void)nanoseconds;
+  }
+};
+
+namespace detail {
+
+inline std::atomic<hook*>& current_hook() {
+  static std::atomic<hook*> h{nullptr};
+  return h;
+}
+
+struct registry {
+  std::mutex m;
+  std::deque<rule_stats> rules; // deque: stats do not move, rules keep pointers to them
+
+  static registry& get() {
+    static registry r;
+    return r;
+  }
+};
+
+// innermost rule running in current thread
+inline rule_stats*& current_rule() {
+  thread_local rule_stats* r = nullptr;
+  return r;
+}
+
+// parsing went back inside of current rule
+inline void note_backtrack() {
+  if (auto r = current_rule()) r->backtracked.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace detail
+
+// stats of rule are created when rule with new name is constructed, rules with same name
+// (redefined rule, rules built at runtime) share them
+inline rule_stats& register_rule(const std::string& name) {
+  auto& r = detail::registry::get();
+  std::lock_guard<std::mutex> lock(r.m);
+  for (auto& s: r.rules) {
+    if (s.name == name) return s;
+  }
+  return r.rules.emplace_back(name);
+}
+
+// hook for all rules, nullptr removes it; hook should outlive parsing
+inline void set_hook(hook* h) { detail::current_hook().store(h); }
+
+template<typename F>
+void for_each_rule(F f) {
+  auto& r = detail::registry::get();
+  std::lock_guard<std::mutex> lock(r.m);
+  for (auto& s: r.rules) f(static_cast<const rule_stats&>(s));
+}
+
+inline void reset() {
+  auto& r = detail::registry::get();
+  std::lock_guard<std::mutex> lock(r.m);
+  for (auto& s: r.rules) s.reset();
+}
+
+inline void dump_text(std::ostream& out) {
+  out << "rule calls successes failures bytes backtracks effects ns\n";
+  for_each_rule([&](const rule_stats& s){
+    out << s.name << ' ' << s.calls << ' ' << s.successes << ' ' << s.failures << ' ' << s.bytes
+        << ' ' << s.backtracks() << ' ' << s.effects << ' ' << s.nanoseconds << '\n';
+  });
+}
+
+inline void dump_json(std::ostream& out) {
+  out << "[";
+  bool first = true;
+  for_each_rule([&](const rule_stats& s){
+    out << (first ? "\n" : ",\n") << "  {\"rule\": \"";
+    for (char c: s.name) {
+      if (c == '"' || c == '\\') out << '\\';
+      out << c;
+    }
+    out << "\", \"calls\": " << s.calls << ", \"successes\": " << s.successes << ", \"failures\": " << s.failures
+        << ", \"bytes\": " << s.bytes << ", \"backtracks\": " << s.backtracks() << ", \"effects\": " << s.effects
+        << ", \"ns\": " << s.nanoseconds << "}";
+    first = false;
+  });
+  out << "\n]\n";
+}
+
+} // namespace comb_parser::profile
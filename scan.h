@@ -0,0 +1,207 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "charset.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define COMB_PARSER_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// SIMD scanning kernels for charsets.
+//
+// Byte is tested against charset with two nibble lookups (pshufb): low nibble selects
+// byte from one of two tables (for high nibbles 0..7 and 8..15), high nibble selects bit in this byte.
+// Kernels are selected at runtime: AVX2, SSE4.2 or scalar fallback.
+
+namespace comb_parser::scan {
+
+// charset prepared for scanning
+class table {
+public:
+  explicit table(const charset::charset& cs) : bitmap(cs.bits()) {
+    for (int c = 0; c < 256; ++c) {
+      if (contains(static_cast<uint8_t>(c))) {
+        auto& t = c < 128 ? lo_tbl : hi_tbl;
+        t[c & 0xF] |= static_cast<uint8_t>(1 << ((c >> 4) & 7));
+      }
+    }
+  }
+
+  bool contains(uint8_t c) const {
+    return (bitmap[c >> 6] & (uint64_t{1} << (c & 0x3F))) != 0;
+  }
+
+  const std::array<uint64_t, 4>& bits() const { return bitmap; }
+
+  alignas(16) uint8_t lo_tbl[16] = {0,}; // chars 0x00..0x7F
+  alignas(16) uint8_t hi_tbl[16] = {0,}; // chars 0x80..0xFF
+
+private:
+  std::array<uint64_t, 4> bitmap;
+};
+
+namespace detail {
+
+template<bool in_set>
+inline const uint8_t* scan_scalar(const table& t, const uint8_t* p, const uint8_t* e) {
+  for (; p != e && t.contains(*p) != in_set; ++p) { }
+  return p;
+}
+
+#ifdef COMB_PARSER_SCAN_X86
+
+// returns mask of bytes, which are members of charset
+__attribute__((target("sse4.2")))
+inline __m128i members_sse(__m128i lo_tbl, __m128i hi_tbl, __m128i bit_tbl, __m128i v) {
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  __m128i lo = _mm_and_si128(v, nibble);
+  __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+  __m128i row = _mm_blendv_epi8(_mm_shuffle_epi8(lo_tbl, lo), _mm_shuffle_epi8(hi_tbl, lo), v);
+  __m128i bit = _mm_shuffle_epi8(bit_tbl, hi);
+  return _mm_cmpeq_epi8(_mm_and_si128(row, bit), bit);
+}
+
+template<bool in_set>
+__attribute__((target("sse4.2")))
+const uint8_t* scan_sse42(const table& t, const uint8_t* p, const uint8_t* e) {
+  const __m128i lo_tbl = _mm_load_si128(reinterpret_cast<const __m128i*>(t.lo_tbl));
+  const __m128i hi_tbl = _mm_load_si128(reinterpret_cast<const __m128i*>(t.hi_tbl));
+  const __m128i bit_tbl = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  for (; e - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned mask = _mm_movemask_epi8(members_sse(lo_tbl, hi_tbl, bit_tbl, v));
+    if constexpr (!in_set) mask = ~mask & 0xFFFF;
+    if (mask) return p + __builtin_ctz(mask);
+  }
+  return scan_scalar<in_set>(t, p, e);
+}
+
+template<bool in_set>
+__attribute__((target("avx2")))
+const uint8_t* scan_avx2(const table& t, const uint8_t* p, const uint8_t* e) {
+  const __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(t.lo_tbl)));
+  const __m256i hi_tbl = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(t.hi_tbl)));
+  const __m256i bit_tbl = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                           1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  for (; e - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo_tbl, lo), _mm256_shuffle_epi8(hi_tbl, lo), v);
+    __m256i bit = _mm256_shuffle_epi8(bit_tbl, hi);
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+    if constexpr (!in_set) mask = ~mask;
+    if (mask) return p + __builtin_ctz(mask);
+  }
+  return scan_sse42<in_set>(t, p, e);
+}
+
+#endif
+
+template<bool in_set>
+using kernel = const uint8_t* (*)(const table&, const uint8_t*, const uint8_t*);
+
+template<bool in_set>
+kernel<in_set> select_kernel() {
+#ifdef COMB_PARSER_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return scan_avx2<in_set>;
+  if (__builtin_cpu_supports("sse4.2")) return scan_sse42<in_set>;
+#endif
+  return scan_scalar<in_set>;
+}
+
+template<bool in_set>
+const uint8_t* scan(const table& t, const uint8_t* p, const uint8_t* e) {
+  static const kernel<in_set> k = select_kernel<in_set>();
+  if (e - p < 16) return scan_scalar<in_set>(t, p, e);
+  return k(t, p, e);
+}
+
+} // namespace detail
+
+// first byte in [p, e), which is not in charset
+inline const uint8_t* skip(const table& t, const uint8_t* p, const uint8_t* e) {
+  return detail::scan<false>(t, p, e);
+}
+
+// first byte in [p, e), which is in charset
+inline const uint8_t* find(const table& t, const uint8_t* p, const uint8_t* e) {
+  return detail::scan<true>(t, p, e);
+}
+
+// iterators over contiguous byte storage, kernels may be used for them
+template<typename Iter>
+struct is_contiguous_bytes : std::false_type { };
+
+template<typename T>
+struct is_contiguous_bytes<T*> : std::bool_constant<sizeof(T) == 1> { };
+
+template<>
+struct is_contiguous_bytes<std::string::iterator> : std::true_type { };
+
+template<>
+struct is_contiguous_bytes<std::string::const_iterator> : std::true_type { };
+
+template<>
+struct is_contiguous_bytes<std::vector<char>::iterator> : std::true_type { };
+
+template<>
+struct is_contiguous_bytes<std::vector<char>::const_iterator> : std::true_type { };
+
+template<>
+struct is_contiguous_bytes<std::vector<uint8_t>::iterator> : std::true_type { };
+
+template<>
+struct is_contiguous_bytes<std::vector<uint8_t>::const_iterator> : std::true_type { };
+
+namespace detail {
+
+template<bool in_set, typename Iter>
+Iter scan_iter(const table& t, Iter pos, Iter end) {
+  if constexpr (is_contiguous_bytes<Iter>::value) {
+    if (pos == end) return pos;
+    auto p = reinterpret_cast<const uint8_t*>(&*pos);
+    return pos + (scan<in_set>(t, p, p + (end - pos)) - p);
+  } else {
+    for (; pos != end && t.contains(static_cast<uint8_t>(*pos)) != in_set; ++pos) { }
+    return pos;
+  }
+}
+
+} // namespace detail
+
+template<typename Iter>
+Iter skip(const table& t, Iter pos, Iter end) { return detail::scan_iter<false>(t, pos, end); }
+
+template<typename Iter>
+Iter find(const table& t, Iter pos, Iter end) { return detail::scan_iter<true>(t, pos, end); }
+
+// literal text at pos, on match pos is moved past it. Only contiguous bytes are compared at once,
+// other iterators are compared with end char by char, so stream iterators see end of buffered data
+template<typename Char, typename Iter>
+bool match_literal(const std::basic_string<Char>& text, Iter& pos, Iter end) {
+  if constexpr (is_contiguous_bytes<Iter>::value && sizeof(Char) == 1) {
+    if (static_cast<std::size_t>(end - pos) < text.size()) return false;
+    if (!text.empty() && std::memcmp(&*pos, text.data(), text.size()) != 0) return false;
+    pos += text.size();
+    return true;
+  } else {
+    auto p = pos;
+    for (auto c: text) {
+      if (p == end || *p != c) return false;
+      ++p;
+    }
+    pos = p;
+    return true;
+  }
+}
+
+} // namespace comb_parser::scan
@@ -0,0 +1,796 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include "comb_parser.h"
+#include "effects.h"
+#include "scan.h"
+
+// Static combinators.
+//
+// Every combinator here is a distinct template type, which holds its children by value,
+// so whole grammar is composed into one type and compiler is free to inline it.
+// There are no std::function calls on the hot path.
+//
+// Semantics are the same as for dynamic parsers from comb_parser.h: parse first, apply effects
+// after successful parse. But effects are not returned as nested closures, they are appended
+// to per-parse log instead, and log is rolled back on backtracking.
+//
+// Static parser may be wrapped into parser<Char, Iter, Args...> (type-erasure boundary),
+// and dynamic parser may be embedded into static grammar via st::dyn.
+
+namespace comb_parser::st {
+
+// Memo table for packrat parsing: (rule, position) -> (matched, end position, effects).
+// Positions are offsets from beginning of input.
+// With non-zero window only entries not farther than window behind the farthest memoized
+// position are kept, so memory stays linear in window size, not in input size.
+class memo_table {
+public:
+  struct entry {
+    bool matched;
+    std::size_t end;
+    std::shared_ptr<effect_log> effects; // null if rule has no effects
+  };
+
+  explicit memo_table(std::size_t window = 0, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : entries(resource), window(window) { }
+
+  std::pmr::memory_resource* resource() const { return entries.get_allocator().resource(); }
+
+  void set_window(std::size_t w) { window = w; }
+
+  const entry* find(std::size_t rule, std::size_t pos, std::size_t last) const {
+    if (window && pos + window < max_pos) return nullptr;
+    auto it = entries.find(key{rule, pos, last});
+    return it != entries.end() ? &it->second : nullptr;
+  }
+
+  void insert(std::size_t rule, std::size_t pos, std::size_t last, entry e) {
+    entries.insert_or_assign(key{rule, pos, last}, std::move(e));
+    if (pos > max_pos) max_pos = pos;
+    if (window && max_pos - swept > window) {
+      evict_before(max_pos - window);
+      swept = max_pos;
+    }
+  }
+
+  // forget entries for positions before pos
+  void evict_before(std::size_t pos) {
+    for (auto it = entries.begin(); it != entries.end(); ) {
+      if (it->first.pos < pos) it = entries.erase(it);
+      else ++it;
+    }
+  }
+
+  // parse is committed up to pos (cut), entries before it are evicted lazily:
+  // when table has grown twice since last eviction
+  void commit(std::size_t pos) {
+    if (pos <= committed) return;
+    committed = pos;
+    if (entries.size() >= 2 * live + 64) {
+      evict_before(committed);
+      live = entries.size();
+    }
+  }
+
+  std::size_t size() const { return entries.size(); }
+
+  void clear() {
+    entries.clear();
+    max_pos = 0;
+    swept = 0;
+    committed = 0;
+    live = 0;
+  }
+
+private:
+  struct key {
+    std::size_t rule;
+    std::size_t pos;
+    std::size_t last; // end of (sub)range, rule may be parsed inside of '%'
+    bool operator==(const key& k) const { return rule == k.rule && pos == k.pos && last == k.last; }
+  };
+
+  struct key_hash {
+    std::size_t operator()(const key& k) const {
+      std::size_t h = k.rule * 0x9E3779B97F4A7C15ull;
+      h ^= k.pos + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+      h ^= k.last + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  std::pmr::unordered_map<key, entry, key_hash> entries;
+  std::size_t window;
+  std::size_t max_pos = 0;
+  std::size_t swept = 0;
+  std::size_t committed = 0;
+  std::size_t live = 0;
+};
+
+// Per-parse state, it may be reused for many parses to reuse memory of effect log.
+// Effect log and memo table allocate from memory resource given to constructor, e.g.
+// monotonic buffer of request, which is released at once after request.
+template<typename Iter = const char*>
+struct state {
+  state() = default;
+  explicit state(std::pmr::memory_resource* resource) : effects(resource), memo(0, resource) { }
+
+  Iter begin{};
+  effect_log effects;
+  memo_table memo;
+  unsigned cut_scopes = 0;
+  bool cut = false; // set by 'p1 > p2', see cut_sequence
+
+  std::size_t offset(Iter pos) const { return std::distance(begin, pos); }
+
+  void reset(Iter b) {
+    begin = b;
+    effects.clear();
+    memo.clear();
+    cut_scopes = 0;
+    cut = false;
+  }
+};
+
+inline std::size_t next_rule_id() {
+  static std::atomic<std::size_t> id{0};
+  return id++;
+}
+
+// Base of all static parsers (CRTP)
+template<typename Derived>
+class base {
+public:
+  const Derived& self() const { return static_cast<const Derived&>(*this); }
+
+  // same interface as dynamic parser has: parse and return effect
+  template<typename Iter, typename ...Args>
+  result operator()(Iter& pos, Iter end, Args...args) const {
+    state<Iter> s;
+    s.reset(pos);
+    if (!self().parse(pos, end, s, args...)) return fail;
+    if (s.effects.empty()) return success;
+    return [fx = std::make_shared<effect_log>(std::move(s.effects))]{ fx->apply(); };
+  }
+
+  // FIRST set analysis: chars which may start a match (unknown by default)
+  // and whether parser may match empty chunk (conservatively yes)
+  std::optional<charset::charset> first() const { return std::nullopt; }
+  bool nullable() const { return true; }
+};
+
+namespace detail {
+
+inline std::optional<charset::charset> first_union(const std::optional<charset::charset>& a,
+                                                  const std::optional<charset::charset>& b) {
+  if (!a || !b) return std::nullopt;
+  return *a + *b;
+}
+
+// FIRST set of sequence p1 + p2
+template<typename P1, typename P2>
+std::optional<charset::charset> first_seq(const P1& p1, const P2& p2) {
+  if (!p1.nullable()) return p1.first();
+  return first_union(p1.first(), p2.first());
+}
+
+} // namespace detail
+
+template<typename T>
+constexpr bool is_parser_v = std::is_base_of_v<base<T>, T>;
+
+//==========
+// Leaf parsers
+
+// single char
+template<typename Char>
+class ch : public base<ch<Char>> {
+  Char c;
+public:
+  constexpr ch(Char c) : c(c) { }
+
+  std::optional<charset::charset> first() const { return charset::charset{std::string(1, c)}; }
+  bool nullable() const { return false; }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State&, Args...) const {
+    if (pos == end || *pos != c) { comb_parser::detail::expected_char(pos, c); return false; }
+    ++pos;
+    return true;
+  }
+};
+
+// zero terminated literal
+template<typename Char>
+class lit : public base<lit<Char>> {
+  const Char* arr;
+public:
+  constexpr lit(const Char* arr) : arr(arr) { }
+
+  std::optional<charset::charset> first() const {
+    if (*arr == 0) return std::nullopt;
+    return charset::charset{std::string(1, *arr)};
+  }
+  bool nullable() const { return *arr == 0; }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State&, Args...) const {
+    auto start = pos;
+    auto it = arr;
+    for (; *it != 0 && pos != end && *it == *pos; ++it, ++pos) { }
+    if (*it == 0) return true;
+    comb_parser::detail::expected_char(pos, *it);
+    pos = start;
+    return false;
+  }
+};
+
+// one or more chars matched by matcher (charset or any other predicate)
+template<typename Matcher>
+class span : public base<span<Matcher>> {
+  Matcher matcher;
+public:
+  span(Matcher m) : matcher(std::move(m)) { }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State&, Args...) const {
+    auto start = pos;
+    for (; pos != end && matcher(*pos); ++pos) { }
+    if (pos != start) return true;
+    comb_parser::detail::expected_set(pos, {0, 0, 0, 0});
+    return false;
+  }
+};
+
+// charset span uses SIMD scanning kernels for contiguous byte input
+template<>
+class span<charset::charset> : public base<span<charset::charset>> {
+  charset::charset cs;
+  scan::table t;
+public:
+  span(const charset::charset& cs) : cs(cs), t(cs) { }
+
+  std::optional<charset::charset> first() const { return cs; }
+  bool nullable() const { return false; }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State&, Args...) const {
+    auto start = pos;
+    pos = scan::skip(t, pos, end);
+    if (pos != start) return true;
+    comb_parser::detail::expected_set(pos, t.bits());
+    return false;
+  }
+};
+
+span(charset::static_charset) -> span<charset::charset>;
+
+// matches end of input
+class end : public base<end> {
+public:
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter last, State&, Args...) const {
+    if (pos == last) return true;
+    comb_parser::detail::expected_end(pos);
+    return false;
+  }
+};
+
+// embeds dynamic parser into static grammar
+template<typename P>
+class dyn : public base<dyn<P>> {
+  P p;
+public:
+  dyn(P p) : p(std::move(p)) { }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto r = p(pos, end, args...);
+    if (!r) return false;
+    s.effects.push(std::move(r));
+    return true;
+  }
+};
+
+//==========
+// Combinators, semantics are the same as of their dynamic counterparts
+
+template<typename P>
+class optional : public base<optional<P>> {
+  P p;
+public:
+  optional(P p) : p(std::move(p)) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    return p.parse(pos, end, s, args...) || !s.cut;
+  }
+};
+
+template<typename P1, typename P2>
+class sequence : public base<sequence<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  sequence(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return detail::first_seq(p1, p2); }
+  bool nullable() const { return p1.nullable() && p2.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p1.parse(pos, end, s, args...)) return false;
+    if (p2.parse(pos, end, s, args...)) return true;
+    s.effects.rollback(m);
+    pos = start;
+    return false;
+  }
+};
+
+template<typename P1, typename P2>
+class choice : public base<choice<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  choice(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return detail::first_union(p1.first(), p2.first()); }
+  bool nullable() const { return p1.nullable() || p2.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    return p1.parse(pos, end, s, args...) || (!s.cut && p2.parse(pos, end, s, args...));
+  }
+};
+
+// effects of p1 are dropped, so it is safe to roll them back before p2
+template<typename P1, typename P2>
+class skip : public base<skip<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  skip(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return detail::first_seq(p1, p2); }
+  bool nullable() const { return p1.nullable() && p2.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p1.parse(pos, end, s, args...)) return false;
+    s.effects.rollback(m);
+    if (p2.parse(pos, end, s, args...)) return true;
+    pos = start;
+    return false;
+  }
+};
+
+template<typename P1, typename P2>
+class check_next : public base<check_next<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  check_next(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return detail::first_seq(p1, p2); }
+  bool nullable() const { return p1.nullable() && p2.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p1.parse(pos, end, s, args...)) return false;
+    auto before_p2 = pos;
+    auto m2 = s.effects.mark();
+    if (!p2.parse(pos, end, s, args...)) {
+      s.effects.rollback(m);
+      pos = start;
+      return false;
+    }
+    s.effects.rollback(m2);
+    pos = before_p2;
+    return true;
+  }
+};
+
+template<typename P>
+class negation : public base<negation<P>> {
+  P p;
+public:
+  negation(P p) : p(std::move(p)) { }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p.parse(pos, end, s, args...)) { s.cut = false; return true; } // cuts do not leave lookahead
+    s.effects.rollback(m);
+    pos = start;
+    return false;
+  }
+};
+
+// p1 % p2: p2 is applied to the chunk matched by p1
+template<typename P1, typename P2>
+class process : public base<process<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  process(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return p1.first(); }
+  bool nullable() const { return p1.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p1.parse(pos, end, s, args...)) return false;
+    auto new_pos = start;
+    if (p2.parse(new_pos, pos, s, args...)) return true;
+    s.effects.rollback(m);
+    pos = start;
+    return false;
+  }
+};
+
+// p % action: action is invoked as action(start, end, args...) on the chunk matched by p.
+// It may return:
+//   bool          - only checks the chunk, no effect
+//   result        - empty one means failure, otherwise it is recorded as effect
+//   any callable  - recorded as effect
+template<typename P, typename F>
+class action : public base<action<P, F>> {
+  P p;
+  F f;
+public:
+  action(P p, F f) : p(std::move(p)), f(std::move(f)) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+  bool nullable() const { return p.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p.parse(pos, end, s, args...)) return false;
+    Iter chunk_start = start;
+    Iter chunk_end = pos;
+    auto r = f(chunk_start, chunk_end, args...);
+    if constexpr (std::is_same_v<decltype(r), bool>) {
+      if (r) return true;
+    } else if constexpr (std::is_constructible_v<bool, decltype(r)>) {
+      if (r) { s.effects.push(std::move(r)); return true; }
+    } else {
+      s.effects.push(std::move(r));
+      return true;
+    }
+    s.effects.rollback(m);
+    pos = start;
+    return false;
+  }
+};
+
+template<typename P>
+class repetition : public base<repetition<P>> {
+  P p;
+  int from_times;
+  int to_times;
+public:
+  repetition(P p, int from_times, int to_times)
+    : p(std::move(p)), from_times(from_times), to_times(to_times) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+  bool nullable() const { return from_times == 0 || p.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    int times = 0;
+    auto start = pos;
+    auto m = s.effects.mark();
+    while (to_times == -1 || times < to_times) {
+      auto before = pos;
+      if (!p.parse(pos, end, s, args...)) break;
+      ++times;
+      if (pos == before) {
+        // p matched empty chunk, it will match it forever: the rest of minimum is matched the same way
+        for (; times < from_times && p.parse(pos, end, s, args...); ++times) { }
+        break;
+      }
+    }
+    if (times >= from_times && !s.cut) return true;
+    s.effects.rollback(m);
+    pos = start;
+    return false;
+  }
+};
+
+// Keywords trie built at compile time:
+//   constexpr auto methods = st::keywords("GET", "POST", "PUT");
+// the longest keyword is matched in one pass, match(pos, end) also returns its index.
+// Trie is stored as first-child/next-sibling nodes in fixed array.
+template<std::size_t Count, std::size_t Nodes>
+class keywords_p : public base<keywords_p<Count, Nodes>> {
+public:
+  template<std::size_t ...Ns>
+  constexpr keywords_p(const char (&...words)[Ns]) {
+    int idx = 0;
+    (insert(words, Ns - 1, idx++), ...);
+  }
+
+  std::optional<charset::charset> first() const {
+    std::string chars;
+    for (auto n = nodes[0].child; n; n = nodes[n].sibling) chars += nodes[n].label;
+    return charset::charset{chars};
+  }
+  bool nullable() const { return nodes[0].value >= 0; }
+
+  // index of the longest keyword at pos, pos is moved after it; -1 if there is no one
+  template<typename Iter>
+  constexpr int match(Iter& pos, Iter end) const {
+    int found = nodes[0].value;
+    auto found_pos = pos;
+    auto p = pos;
+    std::size_t n = 0;
+    while (p != end) {
+      auto c = *p;
+      n = nodes[n].child;
+      while (n && nodes[n].label != c) n = nodes[n].sibling;
+      if (!n) break;
+      ++p;
+      if (nodes[n].value >= 0) { found = nodes[n].value; found_pos = p; }
+    }
+    if (found >= 0) pos = found_pos;
+    return found;
+  }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State&, Args...) const {
+    if (match(pos, end) >= 0) return true;
+    if (comb_parser::detail::active_diagnostics<Iter>()) {
+      std::array<uint64_t, 4> bits{0, 0, 0, 0};
+      for (auto n = nodes[0].child; n; n = nodes[n].sibling) {
+        auto c = static_cast<uint8_t>(nodes[n].label);
+        bits[c >> 6] |= uint64_t{1} << (c & 0x3F);
+      }
+      comb_parser::detail::expected_set(pos, bits);
+    }
+    return false;
+  }
+
+private:
+  struct node {
+    char label = 0;
+    std::size_t child = 0;   // 0: none, root is never a child
+    std::size_t sibling = 0;
+    int value = -1;
+  };
+  std::array<node, Nodes> nodes{};
+  std::size_t used = 1;
+
+  constexpr void insert(const char* w, std::size_t length, int idx) {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < length; ++i) {
+      auto c = nodes[n].child;
+      while (c && nodes[c].label != w[i]) c = nodes[c].sibling;
+      if (!c) {
+        c = used++;
+        nodes[c].label = w[i];
+        nodes[c].sibling = nodes[n].child;
+        nodes[n].child = c;
+      }
+      n = c;
+    }
+    if (nodes[n].value < 0) nodes[n].value = idx;
+  }
+};
+
+template<std::size_t ...Ns>
+constexpr keywords_p<sizeof...(Ns), (Ns + ... + 1)> keywords(const char (&...words)[Ns]) { return {words...}; }
+
+// if FIRST set of p is known, positions between candidates are skipped by scanning kernel
+template<typename P>
+class somewhere_p : public base<somewhere_p<P>> {
+  P p;
+  std::optional<scan::table> candidates;
+public:
+  somewhere_p(P p) : p(std::move(p)) {
+    auto f = this->p.first();
+    if (f && !this->p.nullable()) candidates.emplace(*f);
+  }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    for (; pos != end; ++pos) {
+      if (candidates && (pos = scan::find(*candidates, pos, end)) == end) break;
+      if (p.parse(pos, end, s, args...)) return true;
+      if (s.cut) break;
+    }
+    pos = start;
+    return false;
+  }
+};
+
+// memo(p): packrat memoization of p, results of p are cached in memo table of per-parse state.
+// Context arguments are not part of the key, so p should not depend on them during parsing.
+template<typename P>
+class memo_p : public base<memo_p<P>> {
+  P p;
+  std::size_t rule_id;
+public:
+  memo_p(P p) : p(std::move(p)), rule_id(next_rule_id()) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+  bool nullable() const { return p.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto at = s.offset(pos);
+    auto last = s.offset(end);
+    if (auto e = s.memo.find(rule_id, at, last)) {
+      if (!e->matched) return false;
+      std::advance(pos, e->end - at);
+      if (e->effects) s.effects.push([fx = e->effects]{ fx->apply(); });
+      return true;
+    }
+    effect_log own{s.effects.resource(), 256}; // effects of one rule are usually few
+    s.effects.swap(own);
+    bool matched = p.parse(pos, end, s, args...);
+    s.effects.swap(own);
+    std::shared_ptr<effect_log> fx;
+    if (!own.empty()) {
+      fx = std::allocate_shared<effect_log>(std::pmr::polymorphic_allocator<effect_log>(s.effects.resource()), std::move(own));
+      s.effects.push([fx]{ fx->apply(); });
+    }
+    if (!s.cut) s.memo.insert(rule_id, at, last, {matched, s.offset(pos), std::move(fx)}); // cut failure is not cached
+    return matched;
+  }
+};
+
+// p1 > p2: sequence with cut. Once p1 succeeded inside of cut_scope, parse is committed:
+// failure of p2 sets cut, which fails enclosing alternatives up to cut_scope, and memo entries
+// before the cut are not needed any more, so memo table may release them.
+template<typename P1, typename P2>
+class cut_sequence : public base<cut_sequence<P1, P2>> {
+  P1 p1;
+  P2 p2;
+public:
+  cut_sequence(P1 p1, P2 p2) : p1(std::move(p1)), p2(std::move(p2)) { }
+
+  std::optional<charset::charset> first() const { return detail::first_seq(p1, p2); }
+  bool nullable() const { return p1.nullable() && p2.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    auto start = pos;
+    auto m = s.effects.mark();
+    if (!p1.parse(pos, end, s, args...)) return false;
+    if (s.cut_scopes) s.memo.commit(s.offset(pos));
+    if (p2.parse(pos, end, s, args...)) return true;
+    s.effects.rollback(m);
+    pos = start;
+    if (s.cut_scopes) s.cut = true;
+    return false;
+  }
+};
+
+// cut_scope(p): bounds cuts made inside of p
+template<typename P>
+class cut_scope_p : public base<cut_scope_p<P>> {
+  P p;
+public:
+  cut_scope_p(P p) : p(std::move(p)) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+  bool nullable() const { return p.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    ++s.cut_scopes;
+    bool matched = p.parse(pos, end, s, args...);
+    --s.cut_scopes;
+    s.cut = false;
+    return matched;
+  }
+};
+
+// p * context_gen: supply innermost context
+template<typename P, typename G>
+class with_context : public base<with_context<P, G>> {
+  P p;
+  G context_gen;
+public:
+  with_context(P p, G g) : p(std::move(p)), context_gen(std::move(g)) { }
+
+  std::optional<charset::charset> first() const { return p.first(); }
+  bool nullable() const { return p.nullable(); }
+
+  template<typename Iter, typename State, typename ...Args>
+  bool parse(Iter& pos, Iter end, State& s, Args...args) const {
+    return p.parse(pos, end, s, context_gen(args...), args...);
+  }
+};
+
+//==========
+// Operators
+
+template<typename P>
+optional<P> operator~(const base<P>& p) { return {p.self()}; }
+
+template<typename P>
+negation<P> operator!(const base<P>& p) { return {p.self()}; }
+
+template<typename P1, typename P2>
+sequence<P1, P2> operator+(const base<P1>& p1, const base<P2>& p2) { return {p1.self(), p2.self()}; }
+
+template<typename P1, typename P2>
+choice<P1, P2> operator|(const base<P1>& p1, const base<P2>& p2) { return {p1.self(), p2.self()}; }
+
+template<typename P1, typename P2>
+skip<P1, P2> operator>>(const base<P1>& p1, const base<P2>& p2) { return {p1.self(), p2.self()}; }
+
+template<typename P1, typename P2>
+check_next<P1, P2> operator<<(const base<P1>& p1, const base<P2>& p2) { return {p1.self(), p2.self()}; }
+
+template<typename P1, typename P2>
+cut_sequence<P1, P2> operator>(const base<P1>& p1, const base<P2>& p2) { return {p1.self(), p2.self()}; }
+
+template<typename P1, typename P2>
+auto operator%(const base<P1>& p1, P2 p2) {
+  if constexpr (is_parser_v<P2>) {
+    return process<P1, P2>{p1.self(), std::move(p2)};
+  } else {
+    return action<P1, P2>{p1.self(), std::move(p2)};
+  }
+}
+
+template<typename P, typename G>
+with_context<P, G> operator*(const base<P>& p, G context_gen) { return {p.self(), std::move(context_gen)}; }
+
+template<typename P>
+repetition<P> repeat(const base<P>& p, int from_times=0, int to_times=-1) { return {p.self(), from_times, to_times}; }
+
+template<typename P>
+somewhere_p<P> somewhere(const base<P>& p) { return {p.self()}; }
+
+template<typename P>
+memo_p<P> memo(const base<P>& p) { return {p.self()}; }
+
+template<typename P>
+cut_scope_p<P> cut_scope(const base<P>& p) { return {p.self()}; }
+
+//==========
+// Running
+
+// parse and apply effects on success, state s is reset before parsing
+template<typename P, typename Iter, typename ...Args>
+bool parse(const base<P>& p, Iter& pos, Iter end, state<Iter>& s, Args...args) {
+  s.reset(pos);
+  if (!p.self().parse(pos, end, s, args...)) return false;
+  s.effects.apply();
+  s.reset(pos);
+  return true;
+}
+
+template<typename P, typename Iter, typename ...Args>
+bool parse(const base<P>& p, Iter& pos, Iter end, Args...args) {
+  state<Iter> s;
+  return parse(p, pos, end, s, args...);
+}
+
+} // namespace comb_parser::st
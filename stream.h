@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <utility>
+
+// Streaming (incremental) parsing over chunked input.
+//
+// Input is fed to stream_parser chunk by chunk. Grammar is parsed over bytes buffered so far
+// with stream_iterator, which notices when parser reaches end of available bytes. If it has,
+// result may change when more input comes, so parser suspends with need_more and parsing
+// is resumed from the same point after next chunk.
+//
+// Input is a sequence of items (lines, records, ...), each item is parsed by grammar.
+// Effects of complete item are applied at once and its bytes are dropped, so complete items
+// are never scanned again and buffer holds at most one incomplete item.
+//
+// Parsers are closures with backtracking, they cannot be suspended in the middle of item:
+// incomplete item is re-scanned from its start on every chunk, so item of L bytes, which comes
+// in k chunks, costs O(L*k). Keep items small relative to chunks (whole input as one item is
+// quadratic). Incomplete item longer than max_item (1 MiB by default) fails the stream,
+// so buffered memory is bounded.
+
+namespace comb_parser {
+
+enum class stream_status {
+  done,      // parsed, effects applied
+  need_more, // cannot decide yet, feed more input
+  fail       // parse failed
+};
+
+struct stream_bounds {
+  const char* data_end;
+  bool partial;   // more input may come after data_end
+  bool hit_end;   // parser reached data_end
+};
+
+// iterator over buffered bytes, which records that parser reached end of available data
+class stream_iterator {
+public:
+  using iterator_category = std::random_access_iterator_tag;
+  using value_type = char;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const char*;
+  using reference = const char&;
+
+  stream_iterator() = default;
+  stream_iterator(const char* p, stream_bounds* b) : p(p), b(b) { }
+
+  reference operator*() const { return *p; }
+  reference operator[](difference_type n) const { return p[n]; }
+
+  stream_iterator& operator++() { ++p; return *this; }
+  stream_iterator operator++(int) { auto it = *this; ++p; return it; }
+  stream_iterator& operator--() { --p; return *this; }
+  stream_iterator operator--(int) { auto it = *this; --p; return it; }
+  stream_iterator& operator+=(difference_type n) { p += n; return *this; }
+  stream_iterator& operator-=(difference_type n) { p -= n; return *this; }
+
+  friend stream_iterator operator+(stream_iterator it, difference_type n) { return it += n; }
+  friend stream_iterator operator+(difference_type n, stream_iterator it) { return it += n; }
+  friend stream_iterator operator-(stream_iterator it, difference_type n) { return it -= n; }
+  friend difference_type operator-(const stream_iterator& a, const stream_iterator& b) { return a.p - b.p; }
+
+  // every parser checks for end of input with == or !=
+  friend bool operator==(const stream_iterator& a, const stream_iterator& b) {
+    if (a.p != b.p) return false;
+    if (a.b && a.b->partial && a.p == a.b->data_end) a.b->hit_end = true;
+    return true;
+  }
+  friend bool operator!=(const stream_iterator& a, const stream_iterator& b) { return !(a == b); }
+  friend bool operator<(const stream_iterator& a, const stream_iterator& b) { return a.p < b.p; }
+  friend bool operator>(const stream_iterator& a, const stream_iterator& b) { return a.p > b.p; }
+  friend bool operator<=(const stream_iterator& a, const stream_iterator& b) { return a.p <= b.p; }
+  friend bool operator>=(const stream_iterator& a, const stream_iterator& b) { return a.p >= b.p; }
+
+  const char* get() const { return p; }
+
+private:
+  const char* p = nullptr;
+  stream_bounds* b = nullptr;
+};
+
+// Grammar is any parser callable as grammar(stream_iterator& pos, stream_iterator end, args...) -> result,
+// i.e. parser<char, stream_iterator, Args...> or static parser.
+template<typename Grammar, typename ...Args>
+class stream_parser {
+public:
+  explicit stream_parser(Grammar g, Args...args)
+    : grammar(std::move(g)), args(args...) { }
+
+  stream_status feed(const char* data, std::size_t n) {
+    if (status != stream_status::need_more) return status;
+    buffer.erase(0, consumed);
+    consumed = 0;
+    buffer.append(data, n);
+    return run(false);
+  }
+
+  stream_status feed(const std::string& data) { return feed(data.data(), data.size()); }
+
+  // no more input
+  stream_status finish() {
+    if (status != stream_status::need_more) return status;
+    return run(true);
+  }
+
+  stream_status current_status() const { return status; }
+
+  // number of bytes kept for incomplete item
+  std::size_t buffered() const { return buffer.size() - consumed; }
+
+  // number of parsed items
+  std::size_t items() const { return parsed; }
+
+  // limit of incomplete item, longer one fails
+  void set_max_item(std::size_t n) { max_item = n; }
+
+private:
+  Grammar grammar;
+  std::tuple<Args...> args;
+  std::string buffer;
+  std::size_t consumed = 0;
+  std::size_t parsed = 0;
+  std::size_t max_item = std::size_t{1} << 20;
+  stream_status status = stream_status::need_more;
+
+  stream_status run(bool final) {
+    for (;;) {
+      if (consumed == buffer.size()) {
+        return status = final ? stream_status::done : stream_status::need_more;
+      }
+      stream_bounds b{buffer.data() + buffer.size(), !final, false};
+      const stream_iterator start{buffer.data() + consumed, &b};
+      const stream_iterator end{buffer.data() + buffer.size(), &b};
+      auto pos = start;
+      auto r = std::apply([&](auto...a){ return grammar(pos, end, a...); }, args);
+      if (b.hit_end) return status = buffered() > max_item ? stream_status::fail : stream_status::need_more;
+      if (!r) return status = stream_status::fail;
+      r();
+      ++parsed;
+      auto length = pos.get() - start.get();
+      consumed += length;
+      if (length == 0) return status = stream_status::fail; // item must consume input
+    }
+  }
+};
+
+template<typename Grammar, typename ...Args>
+stream_parser(Grammar, Args...) -> stream_parser<Grammar, Args...>;
+
+} // namespace comb_parser
@@ -1,10 +1,35 @@
 #include "comb_parser.h"
+#include "static_parser.h"
+#include "effects.h"
+#include "scan.h"
+#include "stream.h"
+#include "batch.h"
+#include "mapped_file.h"
+#include "ast.h"
+#include "attr.h"
+#include "async.h"
+#include "vm.h"
+#include "utf8.h"
+#include "trie.h"
 #include "charset.h"
 
+#include <algorithm>
 #include <iostream>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <string>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <variant>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // useful shortcuts
 namespace cp = comb_parser;
@@ -46,22 +71,12 @@ const p uri_path_item = p{!cs{"/?#"}};
 
 //======================================================================================
 // generic data converters
-const auto to_number_conv = [](auto pos, auto end) -> cp::converter_result<int>::type {
-  size_t idx;
-  auto str = std::string(pos, end);
-  int result = std::stoi(str, &idx);
-  if (idx == str.length()) {
-    return [=]{return result;};
-  }
-  return cp::converter_result<int>::fail; // converter may signal failure for next stage
-  // next stage handler decides what to do with failed conversion, it may use
-  // default value instead of converted one
-};
-
-const auto to_string_conv = [](auto pos, auto end) -> cp::converter_result<std::string>::type{
-  auto str = std::string(pos, end);
-  return [=]{return str;};
-};
+// cp::number_conv<T> converts matched chunk with std::from_chars,
+// cp::view_conv gives std::string_view into input, so input should outlive effects.
+// Both of them never allocate.
+// Converter may signal failure for next stage (cp::converter_result<T>::fail),
+// next stage handler decides what to do with failed conversion, it may use
+// default value instead of converted one
 //----------------------------------------------------------------------------------------
 
 
@@ -70,8 +85,8 @@ const auto to_string_conv = [](auto pos, auto end) -> cp::converter_result<std::
 // we should make specialized converters for each parser
 // it is required for converters be able to pass context to
 // next stage handler
-const auto to_number = p::make_converter<int>(to_number_conv);
-const auto to_string = p::make_converter<std::string>(to_string_conv);
+const auto to_number = p::make_converter<int>(cp::number_conv<int>);
+const auto to_view = p::make_converter<std::string_view>(cp::view_conv);
 //---------------------------------------------------------------------
 
 
@@ -109,12 +124,12 @@ struct uri_info{
 using up = p::with_context<uri_info*>;
 
 const auto to_number_u = up::from_converter(to_number);
-const auto to_string_u = up::from_converter(to_string);
+const auto to_view_u = up::from_converter(to_view);
 
 const up schema =
      up{uri_schema}                         // uplift basic parser
-  % (up{"http"} | up{"https"} | up{"ftp"})  // extra filtering of protocols
-  % (to_string_u %                          // using converter of matched substring to standalone string
+  % up::keywords({"http", "https", "ftp"})  // extra filtering of protocols
+  % (to_view_u %                            // using converter of matched substring to string_view
       [](auto str, auto ui)                 // note, that if you return only one lambda, then you do not need '-> result'
         { return [=]{ ui->schema = str();  /* just store it */
         };} );
@@ -133,7 +148,7 @@ const up port =
 
 const up host =
     up{uri_host}
-  % (to_string_u
+  % (to_view_u
   % [](auto str, auto ui)
         { return[=]{ ui->authority = str(); };});
 
@@ -147,9 +162,9 @@ const up authority =
 
 const up path_item =
     up{uri_path_item}                                  // uplevel basic parser
-  % (to_string_u                                       // convert
+  % (to_view_u                                         // convert
   % [](auto str, auto ui) -> result
-        { return [=]{ ui->path.push_back(str()); };}); // store in uir_info
+        { return [=]{ ui->path.emplace_back(str()); };}); // store in uir_info
 
 const up path =
   repeat(up{'/'} >> ~path_item); // /p1/p2/p3
@@ -162,7 +177,8 @@ const up path =
 // var=value;var=value;flag1;flag2
 
 // usere of uri parser won't see this internal context
-using local_context = std::shared_ptr<param_s>;
+// it is pooled and created lazily (see lazy_context in comb_parser.h)
+using local_context = cp::lazy_context<param_s>;
 
 // parser with one more context in addition to uri_info in
 // up parser
@@ -175,12 +191,12 @@ using pc = up::with_context<local_context>;
 // 2. make from lambda
 // unfortunately we shoul make converters for each parser type :(
 const auto to_number_c = pc::from_converter(to_number);
-const auto to_string_c = pc::make_converter<std::string>(to_string_conv);
+const auto to_view_c = pc::make_converter<std::string_view>(cp::view_conv);
 
 
 const pc param_var =
     pc{!cs{"&=;#"}}                // instead of uplifting basic parser, we may build one directly from cahrset
-  % (to_string_c                   // using converter
+  % (to_view_c                   // using converter
   % [] (auto s, auto param, ...){  // ellipsis means that we do not bother deeper (outer) contexts
     param->name = s();             // store in context during parsing stage
     return cp::success;            // return empty effect cp::success as flag of successful parsing
@@ -199,7 +215,7 @@ const pc param_number =
 
 const pc param_string = // parameter either number or string
     pc{!cs{"&;=#"}}
-  % (to_string_c
+  % (to_view_c
   % [](auto str, auto param, ...){
       param->str = str();
       param->type = param_type::string;
@@ -210,8 +226,8 @@ const pc param_pair =
   % [] (auto s, auto e, auto param, auto ui) {               // here we need all contexts
      return [=]{                                             // here we capture all contexts to use them in applying effects stage
         ui->params.push_back(*param);                        // store result in outermost context during stage of effects applying
-     };                                                      // here local_context will be destroyed
-    };                                                       // local_context will be destroyed on closure destruction even we do not apply affects
+     };                                                      // local_context goes back to pool
+    };                                                       // on closure destruction, even we do not apply affects
 
 const up param_flag =
     up{!cs{"&=;#"}}                                              // As in RFC
@@ -221,13 +237,11 @@ const up param_flag =
 const up param =
       up{!cs{"&#;"}}                               // high-level quick parser
     % (                                            // begin more detailed parser
-        (param_pair * [](...){      // downlift pc to up parser by supplying context-generator (pop off innermost context)
-              return std::make_shared<param_s>();  // on every parsing attempt, new context is generated
-              // you may return every time the same pointer, but
-              // it will be used every same for every parsing
-              // id est for every var=val parsing in every URI,
-              // because this lamba is captured in internal parser closure.
-        }
+        (param_pair * cp::context_pool<param_s>{}   // downlift pc to up parser by supplying context (pop off innermost context)
+              // every parsing attempt gets its own frame from pool, param_s is created in it
+              // only when parser touches it, failed attempts return frame to pool at once.
+              // Also context-generator may be used: param_pair * [](...){ return ...; },
+              // it is called on every parsing attempt.
        | // or
          param_flag
       )
@@ -245,6 +259,1210 @@ const up fragment =
 // final URI parser
 const up uri = ~(schema + up{':'}) + ~(up{"//"} >> ~authority) + ~path + ~(up{'?'} >> params) + ~(up{'#'} >> ~fragment);
 
+//=========================================================
+// checks of other parts of library
+
+static int failed_checks = 0;
+
+static void check(bool cond, const char* what) {
+  if (!cond) {
+    std::cout << "FAILED: " << what << std::endl;
+    ++failed_checks;
+  }
+}
+
+// static combinators must behave as dynamic ones
+static void test_static() {
+  namespace st = cp::st;
+
+  const auto s_decimal = st::span{digit};
+  const auto s_hex = st::span{hexdigit};
+  const auto s_IPv4 = repeat(s_decimal + st::ch{'.'}, 3, 3) + s_decimal;
+  const auto s_hextet = s_hex + st::ch{':'};
+  const auto s_IPv6 =
+      (repeat(s_hextet, 7,7) + s_hex)
+    | (st::lit{"::"} >> ~(repeat(s_hextet) + s_hex))
+    | (repeat(s_hextet) + st::ch{':'} + ~(repeat(s_hextet) + s_hex));
+
+  for (std::string in: {"1.2.3.4", "1.2.3", "::1", "fe80::1", "1:2:3:4:5:6:7:8", "zz"}) {
+    auto d_pos = in.begin();
+    auto s_pos = in.begin();
+    bool d = (bool)(IPv4 | IPv6)(d_pos, in.end());
+    bool s = (bool)(s_IPv4 | s_IPv6)(s_pos, in.end());
+    check(d == s && d_pos == s_pos, "static IP parsers match dynamic ones");
+  }
+
+  // effects are applied in order and only for successful branches
+  std::string log;
+  const auto item = [&](char c) {
+    return st::ch{c} % [&log, c](auto, auto) { return [&log, c]{ log += c; }; };
+  };
+  const auto g = repeat((item('a') + item('b') + item('x')) | (item('a') + item('b')) | item('c'));
+  std::string in = "abcab";
+  auto pos = in.begin();
+  check(st::parse(g, pos, in.end()), "static parse succeeds");
+  check(log == "abcab", "static effects are rolled back on backtracking");
+
+  // static parser behind type-erasure boundary
+  log.clear();
+  const p erased{g};
+  pos = in.begin();
+  auto r = erased(pos, in.end());
+  check(r && log.empty(), "effects are deferred");
+  r();
+  check(log == "abcab" && pos == in.end(), "erased static parser");
+}
+
+// effect log: order of effects, rollback, reuse of memory
+static void test_effects() {
+  std::string log;
+  cp::effect_log fx(64);
+  fx.push([&]{ log += 'a'; });
+  auto m = fx.mark();
+  fx.push([&]{ log += 'x'; });
+  std::array<char, 200> big{'B'}; // does not fit into chunk
+  fx.push([&, big]{ log += big[0]; });
+  fx.rollback(m);
+  for (char c = 'b'; c <= 'z'; ++c) fx.push([&, c]{ log += c; });
+  auto counter = std::make_shared<int>(0);
+  fx.push([&, counter]{ log += '!'; });
+  fx.apply();
+  check(log == "abcdefghijklmnopqrstuvwxyz!", "effects are applied in order, rolled back ones are dropped");
+  check(counter.use_count() == 2, "effect is stored in arena");
+  fx.clear();
+  check(fx.empty() && counter.use_count() == 1, "effects are destroyed on clear");
+}
+
+// packrat memoization: each alternative reuses result of memoized prefix
+static void test_memo() {
+  namespace st = cp::st;
+
+  int calls = 0;
+  std::string log;
+  const auto word = st::memo(st::span{[&](char c){ ++calls; return c == 'x'; }}
+                           % [&](auto s, auto e){ return [&log, n = e - s]{ log += std::to_string(n); }; });
+  const auto g = (word + st::ch{'a'}) | (word + st::ch{'b'}) | (word + st::ch{'c'});
+
+  std::string in = "xxxxc";
+  auto pos = in.begin();
+  check(st::parse(g, pos, in.end()) && pos == in.end(), "memoized grammar parses");
+  check(calls == 5, "memoized rule is parsed once");
+  check(log == "4", "effects of memoized rule are applied once");
+
+  // windowed memo table stays bounded on long inputs
+  const auto item = st::memo(st::span{digit}) + st::ch{','};
+  const auto list = repeat((item + st::ch{'!'}) | item);
+  std::string long_in;
+  for (int i = 0; i < 10000; ++i) long_in += "12,";
+  st::state<std::string::iterator> state;
+  state.reset(long_in.begin());
+  state.memo.set_window(64);
+  pos = long_in.begin();
+  check(list.parse(pos, long_in.end(), state) && pos == long_in.end(), "windowed memo parses");
+  check(state.memo.size() < 64, "windowed memo table is bounded");
+}
+
+static void test_memory_resource() {
+  namespace st = cp::st;
+
+  // counts allocations, which go to upstream
+  struct counting_resource : std::pmr::memory_resource {
+    std::pmr::memory_resource* upstream;
+    std::size_t allocations = 0;
+    std::size_t live = 0;
+    explicit counting_resource(std::pmr::memory_resource* u) : upstream(u) { }
+    void* do_allocate(std::size_t n, std::size_t a) override { ++allocations; live += n; return upstream->allocate(n, a); }
+    void do_deallocate(void* p, std::size_t n, std::size_t a) override { live -= n; upstream->deallocate(p, n, a); }
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+  };
+
+  // effect log allocates only from its resource
+  counting_resource counting{std::pmr::new_delete_resource()};
+  {
+    cp::effect_log log{&counting, 256};
+    std::string out;
+    for (int i = 0; i < 100; ++i) log.push([&out, i, pad = std::array<char, 32>{}]{ out += std::to_string(i % 10); (void)pad; });
+    log.apply();
+    check(out.size() == 100 && counting.allocations > 0, "effect log allocates from resource");
+    cp::effect_log other;
+    other.swap(log);
+    check(log.empty() && other.size() == 100, "logs with different resources are swapped");
+  }
+  check(counting.live == 0, "effect log returns memory to resource");
+
+  // per-request monotonic buffer, upstream is null resource, so everything has to fit into buffer
+  std::array<std::byte, 1 << 16> buffer;
+  int words = 0;
+  const auto word = st::memo(st::span{cs{"abcdefghijklmnopqrstuvwxyz"}} % [&](auto, auto){ return [&]{ ++words; }; });
+  const auto g = repeat((word + st::ch{'!'}) | (word + st::ch{';'}));
+  std::string in;
+  for (int i = 0; i < 20; ++i) in += "word;";
+  bool matched = false;
+  try {
+    std::pmr::monotonic_buffer_resource request{buffer.data(), buffer.size(), std::pmr::null_memory_resource()};
+    st::state<std::string::iterator> s{&request};
+    auto pos = in.begin();
+    matched = st::parse(g, pos, in.end(), s) && pos == in.end();
+  } catch (const std::bad_alloc&) {
+  }
+  check(matched && words == 20, "static parse works in monotonic buffer");
+}
+
+// SIMD scanning kernels must agree with charset
+static void test_scan() {
+  namespace st = cp::st;
+
+  std::string data;
+  for (int i = 0; i < 4096; ++i) data += static_cast<char>((i * 7919) >> 3);
+  for (const cs& set: {digit, hexdigit, !cs{"/?#"}, cs{"\x80\xFF"}, !cs{}, cs{}}) {
+    cp::scan::table t{set};
+    bool ok = true;
+    for (size_t from = 0; from < 300; from += 7) {
+      auto it = data.begin() + from;
+      auto not_in = std::find_if(it, data.end(), [&](char c){ return !set(c); });
+      auto in = std::find_if(it, data.end(), [&](char c){ return set(c); });
+      ok = ok && cp::scan::skip(t, it, data.end()) == not_in && cp::scan::find(t, it, data.end()) == in;
+    }
+    check(ok, "scanning kernels agree with charset");
+  }
+
+  std::string path(1000, 'a');
+  path += "/tail";
+  auto pos = path.begin();
+  check(p{!cs{"/?#"}}(pos, path.end()) && pos == path.begin() + 1000, "charset parser stops at first byte outside of set");
+
+  std::string text = std::string(100, ' ') + "12 abc 34";
+  pos = text.begin();
+  check(st::parse(somewhere(st::span{alpha}), pos, text.end()) && pos == text.begin() + 106, "static somewhere skips to candidates");
+  pos = text.begin();
+  check(somewhere(p{alpha}, alpha)(pos, text.end()) && pos == text.begin() + 106, "somewhere with first chars hint");
+}
+
+// compile-time charsets
+static void test_static_charset() {
+  namespace st = cp::st;
+  using scs = cp::charset::static_charset;
+
+  constexpr scs s_alpha = scs::range('a', 'z') + scs::range('A', 'Z');
+  constexpr scs s_digit = scs::range('0', '9');
+  constexpr scs s_hexdigit = s_digit + "ABCDEFabcdef";
+  constexpr scs s_path = !scs{"/?#"};
+  static_assert(s_hexdigit.contains('f') && !s_hexdigit.contains('g'), "set algebra is folded at compile time");
+  static_assert(s_path.contains(0xFF) && !s_path.contains('?'), "complement is folded at compile time");
+  static_assert(s_hexdigit - s_digit == scs{"ABCDEFabcdef"}, "difference is folded at compile time");
+
+  bool same = true;
+  const cs r_alpha = s_alpha;
+  const cs mixed = hexdigit - s_digit;
+  for (int c = 0; c < 256; ++c) {
+    same = same && r_alpha(c) == alpha(c) && mixed(c) == cs{"ABCDEFabcdef"}(c);
+  }
+  check(same, "static charset converts to runtime charset");
+
+  std::string in = "0x1fz";
+  auto pos = in.begin() + 2;
+  check(p{s_hexdigit}(pos, in.end()) && pos == in.begin() + 4, "dynamic parser from static charset");
+  pos = in.begin();
+  check(st::parse(st::span{s_digit}, pos, in.end()) && pos == in.begin() + 1, "static parser from static charset");
+}
+
+// streaming parsing: input is fed in small chunks
+static void test_stream() {
+  namespace st = cp::st;
+
+  std::vector<std::string> lines;
+  const auto line = (st::span{!cs{"\n"}} % [&](auto s, auto e){ return [&lines, l = std::string(s, e)]{ lines.push_back(l); }; })
+                  + st::ch{'\n'};
+  cp::stream_parser sp{line};
+  std::string in = "first line\nsecond\nthird one is long enough\nlast";
+  size_t max_buffered = 0;
+  for (size_t i = 0; i < in.size(); i += 3) {
+    check(sp.feed(in.substr(i, 3)) == cp::stream_status::need_more, "stream needs more input");
+    max_buffered = std::max(max_buffered, sp.buffered());
+  }
+  check(lines.size() == 3 && lines[1] == "second", "complete items are parsed while streaming");
+  check(max_buffered < 30, "only incomplete item is buffered");
+  check(sp.finish() == cp::stream_status::fail && lines.size() == 3, "incomplete last item fails on finish");
+
+  // dynamic parser over stream iterator
+  using sp_t = cp::parser<char, cp::stream_iterator>;
+  const sp_t number = sp_t{digit} + sp_t{';'};
+  cp::stream_parser numbers{number};
+  check(numbers.feed("123") == cp::stream_status::need_more, "number may continue");
+  check(numbers.feed("45;") == cp::stream_status::need_more && numbers.items() == 1, "number is parsed");
+  check(numbers.finish() == cp::stream_status::done, "stream of complete items is done");
+  cp::stream_parser bad{number};
+  check(bad.feed("12x") == cp::stream_status::fail, "failure is reported before end of input");
+
+  // fused literal of compiled tree tests for end of buffered data too
+  using sg = cp::ast::expr<char, cp::stream_iterator>;
+  const sg request = sg{'G'} + sg{'E'} + sg{'T'} + sg{' '} + sg{alpha} + sg{'\n'};
+  cp::stream_parser tree{request.optimize().compile()};
+  check(tree.feed("GE") == cp::stream_status::need_more, "literal of tree may continue in next chunk");
+  check(tree.feed("T x\nGET") == cp::stream_status::need_more && tree.items() == 1, "literal of tree across chunks");
+  cp::stream_parser prog{cp::vm::program{request.optimize()}.as_parser()};
+  check(prog.feed("GE") == cp::stream_status::need_more, "literal of program may continue in next chunk");
+  check(prog.feed("T x\nGET") == cp::stream_status::need_more && prog.items() == 1, "literal of program across chunks");
+
+  // incomplete item is bounded
+  cp::stream_parser big{number};
+  big.set_max_item(64);
+  check(big.feed(std::string(60, '1')) == cp::stream_status::need_more, "item within limit");
+  check(big.feed(std::string(10, '1')) == cp::stream_status::fail, "too long incomplete item fails");
+}
+
+// zero-copy converters
+static void test_converters() {
+  std::string in = "12345x";
+  cp::input_guard guard{in};
+  auto v = cp::view_conv(in.begin(), in.begin() + 5);
+  check(v && v() == "12345" && v().data() == in.data(), "view converter does not copy");
+  auto n = cp::number_conv<int>(in.begin(), in.begin() + 5);
+  check(n && n() == 12345, "number converter");
+  check(!cp::number_conv<int>(in.begin(), in.end()), "number converter requires whole chunk to be number");
+  check(!cp::number_conv<uint8_t>(in.begin(), in.begin() + 5), "number converter checks range");
+
+  cp::stream_bounds b{in.data() + in.size(), false, false};
+  cp::stream_iterator s{in.data(), &b};
+  auto sn = cp::number_conv<long>(s, s + 4);
+  check(sn && sn() == 1234, "number converter for non-contiguous iterators");
+  auto r = cp::range_conv(s, s + 2);
+  check(r && r().begin == s && r().end == s + 2, "range converter");
+}
+
+// parallel batch parsing, results are in order of inputs
+static void test_batch() {
+  namespace st = cp::st;
+
+  std::vector<std::string> inputs;
+  for (int i = 0; i < 1000; ++i) {
+    inputs.push_back(i % 7 ? "http://host" + std::to_string(i) + "/p" + std::to_string(i) + "?a=" + std::to_string(i) : "bad uri");
+  }
+  std::vector<uri_info> infos(inputs.size());
+  std::vector<uri_info*> contexts;
+  for (auto& ui: infos) contexts.push_back(&ui);
+
+  cp::thread_pool pool{4};
+  const up whole_uri = uri + up::end();
+  auto results = cp::parse_batch(pool, whole_uri, inputs, contexts);
+  bool ok = true;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    ok = ok && (bool)results[i] == (i % 7 != 0);
+    if (results[i]) results[i]();
+  }
+  check(ok, "batch parse results are in order of inputs");
+  check(infos[1].authority == "host1" && infos[999].path.at(0) == "p999", "batch effects go to own contexts");
+
+  using Iter = std::string::iterator;
+  std::vector<std::string> hosts(inputs.size());
+  std::vector<std::string*> host_ctx;
+  for (auto& h: hosts) host_ctx.push_back(&h);
+  const auto s_host = st::lit{"http://"} >> (st::span{alpha + digit} % [](Iter s, Iter e, std::string* h){ return [=]{ h->assign(s, e); }; });
+  auto matched = cp::parse_batch_apply(pool, s_host, inputs, host_ctx);
+  ok = true;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    ok = ok && matched[i] == (i % 7 != 0) && (!matched[i] || hosts[i] == "host" + std::to_string(i));
+  }
+  check(ok, "batch parse with static grammar and per-thread state");
+}
+
+// parallel parsing of big separated list
+static void test_parallel_sep_by() {
+  using vp = p::with_context<std::vector<std::string>*>;
+  const vp item = vp{!cs{"&;\""}} % [](auto s, auto e, auto out){ return [=]{ out->emplace_back(s, e); }; };
+  const vp quoted = (vp{'"'} + vp{!cs{"\""}} + vp{'"'}) % [](auto s, auto e, auto out){ return [=]{ out->emplace_back(s, e); }; };
+
+  std::string in;
+  for (int i = 0; i < 20000; ++i) in += "k" + std::to_string(i) + "=v" + std::to_string(i) + (i % 3 ? "&" : ";");
+  in += "&&tail";
+
+  cp::thread_pool pool{4};
+  std::vector<std::string> expected, got;
+  auto pos = in.begin();
+  auto r = repeat(item + ~(vp{'&'} | vp{';'}))(pos, in.end(), &expected);
+  r();
+  auto seq_stop = pos;
+  pos = in.begin();
+  r = cp::parallel_sep_by(pool, item, cs{"&;"}, 1024)(pos, in.end(), &got);
+  r();
+  check(got == expected && pos == seq_stop && got.size() == 20000, "parallel separated list is parsed as sequential one");
+
+  // separators inside of quoted items make chunk boundaries ambiguous
+  std::string quoted_in;
+  for (int i = 0; i < 5000; ++i) quoted_in += "\"a&b;c&d&e&f&g" + std::to_string(i) + "\"&";
+  got.clear();
+  pos = quoted_in.begin();
+  r = cp::parallel_sep_by(pool, quoted | item, cs{"&;"}, 1024)(pos, quoted_in.end(), &got);
+  r();
+  check(got.size() == 5000 && pos == quoted_in.end(), "ambiguous chunks fall back to sequential parsing");
+
+  // item may go on past separator: chunk, which ends at it, is not clean
+  const vp tail_item = (vp{alpha + digit} + ~(vp{'&'} + vp{digit})) % [](auto s, auto e, auto out){ return [=]{ out->emplace_back(s, e); }; };
+  std::string tail_in;
+  for (int i = 0; i < 20000; ++i) tail_in += "ab&12&";
+  expected.clear();
+  got.clear();
+  pos = tail_in.begin();
+  r = repeat(tail_item + ~vp{'&'})(pos, tail_in.end(), &expected);
+  r();
+  seq_stop = pos;
+  pos = tail_in.begin();
+  r = cp::parallel_sep_by(pool, tail_item, cs{"&"}, 1024)(pos, tail_in.end(), &got);
+  r();
+  check(got == expected && pos == seq_stop, "items going past chunk boundary fall back to sequential parsing");
+}
+
+// parsing of memory-mapped file
+static void test_mapped_file() {
+  namespace st = cp::st;
+
+  char path[] = "/tmp/comb_parser_test_XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0, "temporary file is created");
+  if (fd < 0) return;
+  close(fd);
+  {
+    std::ofstream out(path);
+    for (int i = 0; i < 1000; ++i) out << "GET /index" << i << ".html\n";
+  }
+
+  size_t lines = 0;
+  std::string last; // file is unmapped after parse_file, so keep a copy
+  const auto line = st::lit{"GET "} + (st::span{!cs{"\n"}} % [&](const char* s, const char* e){
+                                            return [&, v = std::string_view(s, e - s)]{ ++lines; last = v; }; })
+                  + st::ch{'\n'};
+  auto res = cp::parse_file(path, repeat(line) + st::end{});
+  check(res.matched && lines == 1000 && last == "/index999.html", "mapped file is parsed");
+
+  cp::mapped_file file{path};
+  auto pos = file.begin();
+  check(cp::parser<>{"GET /index0"}(pos, file.end()) && pos == file.begin() + 11, "dynamic parser over mapped file");
+  std::remove(path);
+}
+
+static void test_ast() {
+  using g = cp::ast::expr<char, const char*>;
+
+  check((g{'a'} + (g{'b'} + g{"cd"}) + g{'e'}).optimize().dump() == "\"abcde\"", "adjacent chars and literals are fused");
+  check((g{"x"} | (g{"y"} | g{"z"})).optimize().dump() == "(\"x\" | \"y\" | \"z\")", "nested choices are flattened");
+  check((g{'a'} + (g{'b'} | g{'c'})).optimize().dump() == "('a' + ('b' | 'c'))", "choice is not fused");
+
+  // ordered choice semantics are kept by dispatch: "http" is tried before "https"
+  int tried = 0;
+  const g schema = (g{"https"} | g{"http"} | g{"ftp"} | g{"file"}) + g{':'};
+  const auto plain = schema.compile();
+  const auto fast = schema.optimize().compile();
+  for (std::string in: {"http:", "https:", "ftp:", "file:", "gopher:", "", "f"}) {
+    const char* p1 = in.data();
+    const char* p2 = in.data();
+    auto r1 = plain(p1, in.data() + in.size());
+    auto r2 = fast(p2, in.data() + in.size());
+    check(static_cast<bool>(r1) == static_cast<bool>(r2) && p1 == p2, "optimized grammar matches same input");
+  }
+
+  // only alternatives with matching FIRST set are tried
+  auto probe = [&](char c) {
+    return g{cp::parser<char, const char*>{[&tried, c](const char*& pos, const char* end)->cp::result{
+      ++tried;
+      if (pos == end || *pos != c) return cp::fail;
+      ++pos;
+      return cp::success;
+    }}};
+  };
+  const auto dispatch = ((g{'a'} + probe('1')) | (g{'b'} + probe('2')) | (g{'c'} + probe('3'))).optimize().compile();
+  std::string in = "c3";
+  const char* pos = in.data();
+  tried = 0;
+  check(dispatch(pos, in.data() + in.size()) && tried == 1 && pos == in.data() + 2, "choice dispatches on lookahead byte");
+
+  // nullable alternatives and opaque parsers are always candidates
+  const auto nullable = ((g{'a'} + g{'b'}) | ~g{'x'}).optimize().compile();
+  in = "zz";
+  pos = in.data();
+  check(nullable(pos, in.data() + in.size()) && pos == in.data(), "nullable alternative is tried for any byte");
+  const auto at_end = (g{'a'} | g::end()).optimize().compile();
+  pos = in.data() + in.size();
+  check(static_cast<bool>(at_end(pos, pos)), "end is matched by dispatch");
+
+  // actions
+  std::string seen;
+  const auto act = (g{"ab"} + (g{cs{"xyz"}} % [&](const char*& pos, const char* end)->cp::result{
+                      return [&, c = *pos]{ seen += c; }; })).optimize().compile();
+  in = "abzy";
+  pos = in.data();
+  auto r = act(pos, in.data() + in.size());
+  if (r) r();
+  check(r && seen == "z" && pos == in.data() + 4, "actions work in compiled grammar");
+
+  // sequence without effects does not make closure
+  const auto seq = (g{'a'} + g{cs{"xyz"}} + g{'b'}).compile();
+  in = "azb";
+  pos = in.data();
+  r = seq(pos, in.data() + in.size());
+  check(r && r.target_type() == cp::success.target_type() && pos == in.data() + 3, "sequence without effects returns success");
+}
+
+static void test_cut() {
+  namespace st = cp::st;
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  // "GET" is committed: "GET!" fails whole rule, although "GE" alternative would match
+  const dp method = cut_scope((dp{"GET"} > dp{' '}) | (dp{"GE"} + dp{'T'}) | dp{"GE"});
+  std::string in = "GET!";
+  const char* pos = in.data();
+  check(!method(pos, end_of(in)) && pos == in.data(), "cut fails enclosing scope");
+  in = "GET ";
+  pos = in.data();
+  check(method(pos, end_of(in)) && pos == in.data() + 4, "cut sequence matches");
+  in = "GE";
+  pos = in.data();
+  check(method(pos, end_of(in)) && pos == in.data() + 2, "alternatives are tried before cut");
+
+  // scope ends at cut_scope: outer choice tries its alternatives
+  const dp outer = method | dp{"GET!"};
+  in = "GET!";
+  pos = in.data();
+  check(outer(pos, end_of(in)) && pos == in.data() + 4, "cut does not leave cut_scope");
+
+  // outside of cut_scope '>' is a plain sequence
+  const dp plain = (dp{"GET"} > dp{' '}) | dp{"GE"};
+  in = "GET!";
+  pos = in.data();
+  check(plain(pos, end_of(in)) && pos == in.data() + 2, "cut without scope does not commit");
+
+  // lookahead does not leak cut
+  const dp look = cut_scope(!(dp{'a'} > dp{'b'}) + dp{'a'} | dp{"ax"});
+  in = "ac";
+  pos = in.data();
+  check(look(pos, end_of(in)) && pos == in.data() + 1, "cut inside of negation stays there");
+
+  // grammar trees and bytecode programs honour cuts of embedded parsers
+  {
+    using g = cp::ast::expr<char, const char*>;
+    const dp committed = dp{"GET"} > dp{' '};
+    const auto tree = g{committed} | (g{"GE"} + g{'T'}) | g{"GE"};
+    const auto tree_look = !g{dp{'a'} > dp{'b'}} + g{'a'} | g{"ax"};
+    const auto tree_repeat = repeat(g{dp{"ab"} > dp{';'}}) + g{"ab"};
+    for (const dp& p: {cut_scope(tree.compile()), cut_scope(tree.optimize().compile()),
+                       cut_scope(cp::vm::program{tree}.as_parser()), cut_scope(cp::vm::program{tree.optimize()}.as_parser())}) {
+      in = "GET!";
+      pos = in.data();
+      check(!p(pos, end_of(in)) && pos == in.data(), "cut fails scope of tree and program");
+      in = "GE";
+      pos = in.data();
+      check(p(pos, end_of(in)) && pos == in.data() + 2, "tree and program alternatives before cut");
+    }
+    for (const dp& p: {cut_scope(tree_look.compile()), cut_scope(cp::vm::program{tree_look}.as_parser())}) {
+      in = "ac";
+      pos = in.data();
+      check(p(pos, end_of(in)) && pos == in.data() + 1, "cut inside of negation stays there in tree and program");
+    }
+    for (const dp& p: {cut_scope(tree_repeat.compile()), cut_scope(cp::vm::program{tree_repeat}.as_parser())}) {
+      in = "ab;ab";
+      pos = in.data();
+      check(!p(pos, end_of(in)), "cut fails repeat of tree and program");
+    }
+  }
+
+  // static layer
+  const auto smethod = st::cut_scope((st::lit{"GET"} > st::ch{' '}) | st::lit{"GE"});
+  in = "GET!";
+  pos = in.data();
+  check(!st::parse(smethod, pos, end_of(in)) && pos == in.data(), "static cut fails enclosing scope");
+  in = "GE";
+  pos = in.data();
+  check(st::parse(smethod, pos, end_of(in)) && pos == in.data() + 2, "static alternatives before cut");
+  const auto srepeat = st::cut_scope(repeat(st::lit{"ab"} > st::ch{';'}));
+  in = "ab;ab;ab";
+  pos = in.data();
+  check(!st::parse(srepeat, pos, end_of(in)), "static repeat fails on cut");
+
+  // memo entries behind cut are released
+  int words = 0;
+  const auto word = st::memo(st::span{cs{"abcdefghijklmnopqrstuvwxyz"}} % [&](const char*, const char*){ return [&]{ ++words; }; });
+  const auto list = st::cut_scope(repeat(word > st::ch{';'}));
+  std::string big;
+  for (int i = 0; i < 10000; ++i) big += "word;";
+  st::state<const char*> s;
+  pos = big.data();
+  s.reset(pos);
+  bool matched = list.parse(pos, end_of(big), s);
+  check(matched && pos == end_of(big) && s.memo.size() < 1000, "memo is compacted at cuts");
+  s.effects.apply();
+  check(words == 10000, "effects before cuts are kept");
+}
+
+static void test_longest() {
+  using dp = cp::parser<char, const char*>;
+  using g = cp::ast::expr<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  cp::literal_trie<char> trie{{"in", "int", "integer", "if", "i"}};
+  std::string in = "integral";
+  const char* pos = in.data();
+  check(trie.match(pos, end_of(in)) == 1 && pos == in.data() + 3, "trie finds longest literal");
+  in = "x";
+  pos = in.data();
+  check(trie.match(pos, end_of(in)) == -1 && pos == in.data(), "trie does not match");
+
+  std::string kind;
+  auto tag = [&](const char* k) {
+    return [&, k](const char*&, const char*)->cp::result{ return [&, k]{ kind = k; }; };
+  };
+  const dp ident = dp{cs{"abcdefghijklmnopqrstuvwxyz"}} % tag("ident");
+  const dp number = dp{digit} % tag("number");
+  const dp token = longest(dp{"if"} % tag("if"), dp{"i"} % tag("i"), ident, number);
+
+  in = "iffy";
+  pos = in.data();
+  auto r = token(pos, end_of(in));
+  if (r) r();
+  check(r && pos == end_of(in) && kind == "ident", "longest match wins");
+  in = "if(";
+  pos = in.data();
+  r = token(pos, end_of(in));
+  if (r) r();
+  check(r && pos == in.data() + 2 && kind == "if", "first of equal matches wins");
+
+  // cut failed inside of one alternative does not fail others or what follows
+  const dp cut_alt = cp::cut_scope(longest(dp{'a'} > dp{'b'}, dp{"a"}) + (dp{'c'} | dp{'d'}));
+  in = "ad";
+  pos = in.data();
+  check(cut_alt(pos, end_of(in)) && pos == end_of(in), "cut inside of longest alternative is local");
+
+  // literals are merged into trie
+  const auto tree = longest(g{"if"}, g{"int"}, g{"in"}, g{ident}).optimize();
+  check(tree.dump() == "longest(parser, trie[3])", "literals of longest are merged into trie");
+  const auto compiled = tree.compile();
+  for (std::string w: {"int", "in", "if", "inter", "x", ""}) {
+    kind.clear();
+    const char* p1 = w.data();
+    const char* p2 = w.data();
+    auto r1 = longest(dp{"if"}, dp{"int"}, dp{"in"}, ident)(p1, end_of(w));
+    auto r2 = compiled(p2, end_of(w));
+    check(static_cast<bool>(r1) == static_cast<bool>(r2) && p1 == p2, "compiled longest matches like dynamic one");
+  }
+  in = "int";
+  pos = in.data();
+  kind.clear();
+  r = compiled(pos, end_of(in));
+  if (r) r();
+  check(r && kind.empty(), "literal alternative before parser wins equal match");
+}
+
+static void test_keywords() {
+  namespace st = cp::st;
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  const auto schemes = dp::keywords({"http", "https", "ftp", "file"});
+  std::string in = "https://";
+  const char* pos = in.data();
+  check(schemes(pos, end_of(in)) && pos == in.data() + 5, "keywords match longest keyword");
+  in = "gopher://";
+  pos = in.data();
+  check(!schemes(pos, end_of(in)) && pos == in.data(), "keywords do not match");
+
+  std::size_t method = 100;
+  const auto methods = dp::keywords({"GET", "POST", "PUT", "PATCH"}, [&](std::size_t idx)->cp::result{
+    return [&, idx]{ method = idx; };
+  });
+  in = "PATCH /";
+  pos = in.data();
+  auto r = methods(pos, end_of(in));
+  if (r) r();
+  check(r && method == 3 && pos == in.data() + 5, "index of keyword is passed to process");
+
+  // built at compile time
+  static constexpr auto smethods = st::keywords("GET", "POST", "PUT", "PATCH");
+  static_assert([]{
+    const char* s = "PUTS";
+    const char* p = s;
+    return smethods.match(p, s + 4) == 2 && p == s + 3;
+  }(), "constexpr keywords");
+  in = "POST /";
+  pos = in.data();
+  check(st::parse(smethods, pos, end_of(in)) && pos == in.data() + 4, "static keywords match");
+  check(smethods.first() && (*smethods.first())('G') && !(*smethods.first())('X'), "FIRST set of keywords");
+}
+
+static void test_rules() {
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  int numbers = 0;
+  const auto word = cp::rule("word", dp{alpha});
+  const auto number = cp::rule("number", dp{digit} % [&](const char*&, const char*)->cp::result{ return [&]{ ++numbers; }; });
+  const auto item = cp::rule("item", word | number);
+  const dp list = item + repeat(dp{','} >> item);
+  check(word.name() == "word", "rule has name");
+
+  std::string in = "abc,12,x";
+  const char* pos = in.data();
+  auto r = list(pos, end_of(in));
+  if (r) r();
+  check(r && pos == end_of(in) && numbers == 1, "rules parse as their parsers");
+
+  const auto ab = cp::rule("ab", dp{"ab"});
+  const auto backtracking = cp::rule("backtracking", ab + dp{'!'} | dp{"abc"});
+  in = "abc";
+  pos = in.data();
+  r = backtracking(pos, end_of(in));
+  if (r) r();
+
+  struct stats { uint64_t calls, successes, failures, bytes, backtracks, effects; };
+  std::map<std::string, stats> seen;
+  cp::profile::for_each_rule([&](const cp::profile::rule_stats& s){
+    seen[s.name] = {s.calls, s.successes, s.failures, s.bytes, s.backtracks(), s.effects};
+  });
+#ifdef COMB_PARSER_PROFILE
+  auto& w = seen["word"];
+  check(w.calls == 3 && w.successes == 2 && w.failures == 1 && w.bytes == 4 && w.backtracks == 0, "word rule stats");
+  auto& n = seen["number"];
+  check(n.calls == 1 && n.successes == 1 && n.bytes == 2 && n.effects == 1, "number rule stats");
+  check(seen["item"].calls == 3 && seen["item"].successes == 3, "item rule stats");
+  check(seen["ab"].successes == 1 && seen["ab"].backtracks == 0, "rule without sequences does not backtrack");
+  check(seen["backtracking"].successes == 1 && seen["backtracking"].backtracks == 1, "failed sequence is counted as backtrack");
+  check(seen["number"].effects == 1 && seen["word"].effects == 0, "success is not counted as effect");
+
+  struct counting_hook : cp::profile::hook {
+    int enters = 0;
+    std::size_t consumed = 0;
+    void on_enter(const cp::profile::rule_stats&) override { ++enters; }
+    void on_exit(const cp::profile::rule_stats&, bool, std::size_t c, uint64_t) override { consumed += c; }
+  } h;
+  cp::profile::set_hook(&h);
+  in = "abc";
+  pos = in.data();
+  list(pos, end_of(in));
+  cp::profile::set_hook(nullptr);
+  check(h.enters == 2 && h.consumed == 6, "profile hook is called for rules");
+
+  std::ostringstream json;
+  cp::profile::dump_json(json);
+  check(json.str().find("\"rule\": \"word\"") != std::string::npos, "profile is dumped as JSON");
+
+  // redefined rule and rules with same name share one row
+  cp::rule<char, const char*> twice{"twice"};
+  twice = dp{'a'};
+  twice = dp{'b'};
+  const auto again = cp::rule("twice", dp{'c'});
+  int rows = 0;
+  cp::profile::for_each_rule([&](const cp::profile::rule_stats& s){ rows += s.name == "twice"; });
+  check(rows == 1, "rule name is registered once");
+#else
+  check(seen.empty(), "rules are not instrumented without COMB_PARSER_PROFILE");
+#endif
+}
+
+static void test_shared_rules() {
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  // subparsers are shared, not copied: 2^40 paths, but only 41 nodes
+  dp x = dp{'a'};
+  for (int i = 0; i < 40; ++i) x = x | x;
+  std::string in = "a";
+  const char* pos = in.data();
+  check(x(pos, end_of(in)) && pos == end_of(in), "shared nodes parse");
+
+  // recursive rules: value = number | '(' value* ')', effects sum numbers
+  int sum = 0;
+  const auto to_number = dp::make_converter<int>(cp::number_conv<int>);
+  cp::rule<char, const char*> value{"value"};
+  const dp number = dp{digit} % (to_number % [&](auto v)->cp::result{ return [&sum, v]{ sum += v(); }; });
+  const dp list = dp{'('} + repeat(value + ~dp{' '}) + dp{')'};
+  in = "(1 (2 (3 4)) ((5)))";
+  pos = in.data();
+  check(!value(pos, end_of(in)) && pos == in.data(), "declared rule fails until it is defined");
+  value = number | list;
+  auto r = value(pos, end_of(in));
+  if (r) r();
+  check(r && pos == end_of(in) && sum == 15, "recursive rule parses nested lists");
+  in = "(1 (2)";
+  pos = in.data();
+  check(!value(pos, end_of(in)) && pos == in.data(), "recursive rule fails on unbalanced input");
+
+  // assignment of rule to declared rule defines it, parsers built earlier see definition
+  cp::rule<char, const char*> item{"item"};
+  const dp items = repeat(item + ~dp{','});
+  cp::rule<char, const char*> word{"word", dp{alpha}};
+  item = word;
+  in = "ab,cd";
+  pos = in.data();
+  check(items(pos, end_of(in)) && pos == end_of(in), "declared rule defined by other rule");
+  item = cp::rule<char, const char*>{"digits", dp{digit}};
+  in = "12,3";
+  pos = in.data();
+  check(items(pos, end_of(in)) && pos == end_of(in), "declared rule redefined by temporary rule");
+  bool thrown = false;
+  try {
+    word = dp{digit};
+  } catch (const std::logic_error&) {
+    thrown = true;
+  }
+  check(thrown, "defined rule cannot be redefined");
+
+  // destroyed declared rule fails instead of dangling
+  dp orphan;
+  {
+    cp::rule<char, const char*> inner{"inner"};
+    inner = dp{digit};
+    orphan = inner + dp::end();
+  }
+  pos = in.data();
+  check(!orphan(pos, end_of(in)), "parser of destroyed rule fails");
+}
+
+// diagnostics: farthest failure position and expected set
+static void test_diagnostics() {
+  namespace st = cp::st;
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  const auto host = cp::rule("host", dp{alpha});
+  const auto port = cp::rule("port", dp{digit});
+  const dp authority = (dp{"http"} | dp{"ftp"}) + dp{"://"} + host + ~(dp{':'} + port) + dp::end();
+
+  std::string in = "http://example:x";
+  const char* pos = in.data();
+  cp::diagnostics<const char*> diag{in.data()};
+  {
+    auto active = diag.activate();
+    check(!authority(pos, end_of(in)), "malformed authority fails");
+  }
+  check(diag.failed() && diag.offset() == 15 && diag.position() == in.data() + 15, "farthest failure position");
+  check(diag.expected_chars()('7') && !diag.expected_chars()(':') && !diag.expected_end(), "expected chars at farthest position");
+#ifdef COMB_PARSER_DIAGNOSTICS
+  check(diag.expected_rules().size() == 1, "failed rule is expected");
+  check(diag.message() == "offset 15: expected one of '0'-'9' or rule 'port'", "message of diagnostics");
+#else
+  check(diag.expected_rules().empty(), "rules are not reported without COMB_PARSER_DIAGNOSTICS");
+  check(diag.message() == "offset 15: expected '0'-'9'", "message of diagnostics");
+#endif
+
+  // alternatives failing at the same position are merged, nearer failures are ignored
+  diag.clear();
+  in = "htt";
+  pos = in.data();
+  {
+    auto active = diag.activate();
+    authority(pos, end_of(in));
+  }
+  check(diag.offset() == 3 && diag.expected_chars()('p') && !diag.expected_chars()('f'), "only farthest failure is kept");
+
+  // without active diagnostics nothing is reported
+  diag.clear();
+  pos = in.data();
+  authority(pos, end_of(in));
+  check(!diag.failed(), "inactive diagnostics");
+
+  // static parsers report too
+  const auto s_g = st::lit{"GET"} + st::ch{' '} + st::span{digit} + st::end{};
+  in = "GET 12a";
+  pos = in.data();
+  {
+    auto active = diag.activate();
+    check(!st::parse(s_g, pos, end_of(in)), "static parse fails");
+  }
+  check(diag.offset() == 6 && diag.expected_end() && diag.message() == "offset 6: expected end of input",
+        "static parsers report expected end");
+
+  // grammar trees and bytecode programs report as combinators
+  {
+    using g = cp::ast::expr<char, const char*>;
+    const auto tree = (g{"http"} | g{"ftp"}) + g{"://"} + g{alpha} + ~(g{':'} + g{digit}) + g::end();
+    std::vector<std::string> messages;
+    for (const dp& p: {tree.compile(), tree.optimize().compile(), cp::vm::program{tree}.as_parser(),
+                       cp::vm::program{tree.optimize()}.as_parser()}) {
+      for (std::string bad: {"http://example:x", "htt", "gopher"}) {
+        cp::diagnostics<const char*> d{bad.data()};
+        pos = bad.data();
+        {
+          auto active = d.activate();
+          p(pos, end_of(bad));
+        }
+        messages.push_back(d.message());
+      }
+    }
+    bool same = true;
+    for (std::size_t k = 3; k < messages.size(); ++k) same = same && messages[k] == messages[k % 3];
+    check(same && messages[0] == "offset 15: expected '0'-'9'" && messages[1] == "offset 3: expected 'p'"
+          && messages[2] == "offset 0: expected one of 'f' or 'h'", "trees and programs report as combinators");
+  }
+
+  // code points above byte range are not mistaken for bytes
+  {
+    using wp = cp::parser<char32_t, const char32_t*>;
+    const wp w = wp{U'я'} | wp{U'é'};
+    std::u32string win = U"z";
+    const char32_t* wpos = win.data();
+    cp::diagnostics<const char32_t*> d{win.data()};
+    {
+      auto active = d.activate();
+      w(wpos, win.data() + win.size());
+    }
+    check(d.failed() && d.expected_chars()(0xE9) && !d.expected_chars()(0x4F), "expected code points");
+  }
+}
+
+// typed attributes: values are written into user structures without effect closures
+static void test_attributes() {
+  namespace at = cp::attr;
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  struct endpoint {
+    std::string scheme;
+    std::string host;
+    std::optional<int> port;
+    std::vector<std::string> path;
+  };
+  const auto segment = '/' + at::text(dp{alpha});
+  const auto g = at::into<endpoint>(
+      at::text(dp{alpha}) + "://" + at::text(dp{alpha}) + ~(':' + at::number<int>(dp{digit})) + repeat(segment),
+      &endpoint::scheme, &endpoint::host, &endpoint::port, &endpoint::path);
+  static_assert(std::is_same_v<decltype(segment)::attribute, std::string>, "unused attributes are dropped");
+  static_assert(std::is_same_v<decltype(g)::attribute, endpoint>, "fields are bound to struct");
+
+  std::string in = "http://example:8080/a/b";
+  const char* pos = in.data();
+  endpoint e;
+  check(at::parse(g, pos, end_of(in), e) && pos == end_of(in), "typed parse succeeds");
+  check(e.scheme == "http" && e.host == "example" && e.port == 8080, "fields are filled");
+  check(e.path == std::vector<std::string>{"a", "b"}, "repeat fills container");
+  in = "ftp://host";
+  pos = in.data();
+  check(at::parse(g, pos, end_of(in), e) && !e.port && e.path.empty(), "optional and empty container");
+
+  // alternatives make variant, same types are merged
+  const auto value = at::number<int>(dp{digit}) | at::text(dp{alpha}) | at::number<int>(dp{'-'} + dp{digit});
+  static_assert(std::is_same_v<decltype(value)::attribute, std::variant<int, std::string>>, "variant of alternatives");
+  const auto list = value + repeat(',' + value);
+  in = "12,abc,-3";
+  pos = in.data();
+  std::tuple<std::variant<int, std::string>, std::vector<std::variant<int, std::string>>> t;
+  check(at::parse(list, pos, end_of(in), t) && pos == end_of(in), "list of values");
+  check(std::get<0>(std::get<0>(t)) == 12 && std::get<1>(std::get<1>(t)[0]) == "abc" && std::get<0>(std::get<1>(t)[1]) == -3,
+        "values are parsed in variants");
+
+  // attribute is transformed with %, failed sequence restores position
+  const auto sum = (at::number<int>(dp{digit}) + '+' + at::number<int>(dp{digit})) % [](std::tuple<int, int> v){
+    return std::get<0>(v) + std::get<1>(v);
+  };
+  int s = 0;
+  in = "20+22";
+  pos = in.data();
+  check(at::parse(sum, pos, end_of(in), s) && s == 42, "attribute is transformed");
+  in = "20+x";
+  pos = in.data();
+  check(!at::parse(sum, pos, end_of(in), s) && pos == in.data(), "failed typed sequence restores position");
+}
+
+// async parsing: many parses are in flight in one thread, each suspends while its socket is empty
+static void test_async() {
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+  namespace st = cp::st;
+  constexpr int connections = 64;
+
+  const auto line = [](int* count) {
+    return (st::span{!cs{"\n"}} % [count](auto, auto){ return [count]{ ++*count; }; }) + st::ch{'\n'};
+  };
+  using line_t = decltype(line(nullptr));
+
+  cp::io_loop loop;
+  std::vector<int> lines(connections, 0);
+  std::vector<int> readers, writers;
+  std::vector<std::unique_ptr<cp::fd_source>> sources;
+  std::vector<std::unique_ptr<cp::async_parser<line_t>>> parsers;
+  std::vector<cp::task<cp::stream_status>> tasks;
+  for (int i = 0; i < connections; ++i) {
+    int sv[2];
+    check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair is created");
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    readers.push_back(sv[0]);
+    writers.push_back(sv[1]);
+    sources.push_back(std::make_unique<cp::fd_source>(sv[0], loop));
+    parsers.push_back(std::make_unique<cp::async_parser<line_t>>(line(&lines[i])));
+    tasks.push_back(parsers.back()->parse(*sources.back()));
+    tasks.back().start();
+  }
+  check(loop.pending() == connections, "parses wait for input");
+
+  bool written = true;
+  for (int fd: writers) written = written && write(fd, "GET / HTTP/1.1\nHo", 17) == 17;
+  while (loop.poll_once(0)) { }
+  check(written && loop.pending() == connections && lines[0] == 1, "complete line is parsed, parse waits for the rest");
+
+  for (int fd: writers) {
+    written = written && write(fd, "st: x\n", 6) == 6;
+    close(fd);
+  }
+  loop.run();
+  bool done = written;
+  for (int i = 0; i < connections; ++i) {
+    done = done && tasks[i].done() && tasks[i].result() == cp::stream_status::done && lines[i] == 2;
+  }
+  check(done, "all parses are done");
+  for (int fd: readers) close(fd);
+#endif
+}
+
+// bytecode backend: same results as grammar compiled into parsers
+static void test_vm() {
+  using g = cp::ast::expr<char, const char*>;
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  const g octet = g{digit};
+  const g host = (repeat(octet + g{'.'}, 3, 3) + octet) | g{alpha + cs{".-"}};
+  const g port = g{':'} >> g{digit};
+  const g segment = g{'/'} + ~g{!cs{"/?#"}};
+  const g grammar = (g{"https"} | g{"http"} | g{"ftp"}) + g{"://"} + host + ~port + repeat(segment)
+                  + ~(g{'?'} + g{!cs{"#"}} << g{'#'}) + !g{'x'} + ~g{'#'} + g::end();
+  for (auto tree: {grammar, grammar.optimize()}) {
+    const auto expected = tree.compile();
+    const cp::vm::program prog{tree};
+    bool same = true;
+    for (std::string in: {"http://1.2.3.4:80/a/b", "https://example.com/", "ftp://x//y?q#", "ftp://x?q", "gopher://x",
+                          "http://1.2.3", "http://a:", "http://a/x", ""}) {
+      const char* p1 = in.data();
+      const char* p2 = in.data();
+      auto r1 = expected(p1, end_of(in));
+      auto r2 = prog(p2, end_of(in));
+      same = same && static_cast<bool>(r1) == static_cast<bool>(r2) && p1 == p2;
+    }
+    check(same, "program matches same input as compiled grammar");
+  }
+
+  // effects of actions and opaque parsers are applied in order, backtracked ones are dropped
+  std::string log;
+  auto note = [&](const char* what) {
+    return [&log, what](const char*&, const char*)->cp::result{ return [&log, what]{ log += what; }; };
+  };
+  const dp opaque = dp{'!'} % [&](const char*&, const char*)->cp::result{ return [&log]{ log += "!"; }; };
+  const g items = repeat((g{"ab"} % note("A")) + g{'x'} | (g{'a'} % note("a")) + g{opaque} | (g{'b'} % note("b")), 1);
+  const cp::vm::program prog{items.optimize()};
+  std::string in = "abxa!b";
+  const char* pos = in.data();
+  auto r = prog(pos, end_of(in));
+  if (r) r();
+  check(r && pos == end_of(in) && log == "Aa!b", "effects of program");
+
+  // skip drops effects of its left side, negation and check-next do not consume input
+  log.clear();
+  const cp::vm::program skip{(g{'a'} % note("a")) >> (g{'b'} % note("b")) << g{'c'}};
+  in = "abc";
+  pos = in.data();
+  r = skip(pos, end_of(in));
+  if (r) r();
+  check(r && pos == in.data() + 2 && log == "b", "skip and check-next in program");
+
+  // no recursion: long repeat of choices runs in one loop
+  const auto long_list = cp::vm::program{repeat(g{'a'} | g{'b'})}.as_parser();
+  in = std::string(100000, 'a') + "b";
+  pos = in.data();
+  check(long_list(pos, end_of(in)) && pos == end_of(in), "long input in program");
+
+  // wide chars are not in FIRST tables, their alternatives are tried as in tree
+  using wg = cp::ast::expr<char32_t, const char32_t*>;
+  const wg wide = (wg{U'\u0142'} | wg{U'x'}).optimize();
+  const auto wide_tree = wide.compile();
+  const cp::vm::program wide_prog{wide};
+  bool same = true;
+  for (std::u32string win: {U"\u0142", U"x", U"y", U"\u0143"}) {
+    const char32_t* p1 = win.data();
+    const char32_t* p2 = win.data();
+    auto r1 = wide_tree(p1, win.data() + win.size());
+    auto r2 = wide_prog(p2, win.data() + win.size());
+    same = same && static_cast<bool>(r1) == static_cast<bool>(r2) && p1 == p2;
+  }
+  std::u32string win = U"\u0142";
+  const char32_t* wpos = win.data();
+  check(same && wide_prog(wpos, win.data() + win.size()) && wpos == win.data() + 1, "wide choice in program");
+}
+
+// repeat: bounds, charset collapse, effects only of iterations which have them
+static void test_repeat() {
+  using dp = cp::parser<char, const char*>;
+  auto end_of = [](const std::string& str) { return str.data() + str.size(); };
+
+  // exact count does not take one more iteration
+  const dp ipv4 = repeat(dp{digit} + dp{'.'}, 3, 3) + dp{digit};
+  std::string in = "1.2.3.4.5";
+  const char* pos = in.data();
+  check(ipv4(pos, end_of(in)) && pos == in.data() + 7, "exact count repeat");
+  in = "1.2.";
+  pos = in.data();
+  check(!ipv4(pos, end_of(in)) && pos == in.data(), "exact count repeat fails on fewer items");
+  const dp up_to_two = repeat(dp{'a'}, 0, 2);
+  in = "aaa";
+  pos = in.data();
+  check(up_to_two(pos, end_of(in)) && pos == in.data() + 2, "upper bound of repeat");
+
+  // repeated charset is a span
+  const dp digits = repeat(dp{digit});
+  in = "123x";
+  pos = in.data();
+  check(digits(pos, end_of(in)) && pos == in.data() + 3, "repeated charset");
+  pos = in.data() + 3;
+  check(digits(pos, end_of(in)) && pos == in.data() + 3, "repeated charset may match nothing");
+  pos = in.data() + 3;
+  check(!repeat(dp{digit}, 1)(pos, end_of(in)) && !repeat(dp{digit}, 2)(pos = in.data(), end_of(in)),
+        "repeated charset with lower bound");
+
+  // nullable parser at end of input
+  pos = end_of(in);
+  check(static_cast<bool>(repeat(~dp{'x'}, 1)(pos, end_of(in))), "nullable parser is repeated at end of input");
+
+  // effect-free iterations are not stored, effects of others are applied in order
+  std::string log;
+  const dp letter = dp{alpha} % [&](const char*& s, const char* e)->cp::result{
+    return [&log, l = std::string(s, e)]{ log += l; };
+  };
+  const dp items = repeat((letter | dp{digit}) + ~dp{','});
+  in = "ab,12,cd,3";
+  pos = in.data();
+  auto r = items(pos, end_of(in));
+  if (r) r();
+  check(r && pos == end_of(in) && log == "abcd", "effects of repeat");
+  in = "12,3";
+  pos = in.data();
+  r = items(pos, end_of(in));
+  check(r && r.target_type() == cp::success.target_type(), "repeat without effects returns success");
+
+  // body matching empty chunk counts for the rest of minimum
+  in = "b";
+  for (int to: {3, 4, -1}) {
+    pos = in.data();
+    check(repeat(~dp{'a'}, 3, to)(pos, end_of(in)) && pos == in.data(), "repeat of empty match reaches minimum");
+    cp::st::state<const char*> s;
+    pos = in.data();
+    check(cp::st::parse(repeat(~cp::st::ch{'a'}, 3, to), pos, end_of(in), s) && pos == in.data(),
+          "static repeat of empty match reaches minimum");
+    std::vector<std::optional<std::string>> out;
+    pos = in.data();
+    check(cp::attr::parse(repeat(~cp::attr::text(dp{'a'}), 3, to), pos, end_of(in), out) && out.size() == 3,
+          "typed repeat of empty match reaches minimum");
+  }
+}
+
+// UTF-8: code-point charsets over decoding iterator, validation
+static void test_utf8() {
+  namespace u8 = cp::utf8;
+  using up = cp::parser<char32_t, u8::iterator<const char*>>;
+
+  const u8::charset letters = u8::charset::range(U'a', U'z') + u8::charset::range(0x430, 0x44F) + u8::charset{U"ßéü"};
+  check(letters(U'ß') && letters(U'я') && letters(U'q') && !letters(U'Z') && !letters(0x10FFFF), "code-point charset");
+  check((!letters)(U'Z') && !(!letters)(U'é') && (letters - u8::charset{U"é"})(U'ü') && !(letters - u8::charset{U"é"})(U'é'),
+        "code-point charset algebra");
+
+  const up word = up{letters};
+  const up greeting = word + up{U", "} + word + up{U'!'} + up::end();
+  std::string in = "grüße, привет!";
+  auto pos = u8::begin(in);
+  check(greeting(pos, u8::end(in)) && pos == u8::end(in), "code-point parser over UTF-8");
+
+  // long ASCII runs with non-ASCII code points inside are one span
+  in = std::string(100, 'a') + "é" + std::string(100, 'b') + "Z";
+  pos = u8::begin(in);
+  check(word(pos, u8::end(in)) && pos.base() == in.data() + 202 && *pos == U'Z', "span of code points");
+
+  // byte charset is Latin-1 range of code points, invalid sequence is U+FFFD
+  const up digits = up{u8::charset{digit}};
+  in = "42\xff";
+  pos = u8::begin(in);
+  check(digits(pos, u8::end(in)) && *pos == u8::replacement, "invalid sequence is read as replacement char");
+
+  check(u8::validate(std::string(1000, 'x')).ascii, "ASCII input");
+  auto v = u8::validate(std::string(40, 'x') + "жук");
+  check(v.valid && !v.ascii, "valid UTF-8 input");
+  in = std::string(40, 'x') + "\xe0\x80\x80" + "y";   // overlong
+  v = u8::validate(in);
+  check(!v.valid && v.error == in.data() + 40, "invalid sequence position");
+  in = "\xed\xa0\x80";                                 // surrogate
+  check(!u8::validate(in).valid && !u8::validate(std::string("\xf0\x9f")).valid, "surrogates and truncated sequences are invalid");
+
+  // diagnostics works over forward iterators too
+  in = "ab1";
+  pos = u8::begin(in);
+  cp::diagnostics<u8::iterator<const char*>> diag{u8::begin(in)};
+  {
+    auto active = diag.activate();
+    greeting(pos, u8::end(in));
+  }
+  check(diag.offset() == 2 && diag.expected_chars()(','), "diagnostics over UTF-8 iterator");
+}
+
+// layered contexts from pool: created lazily, frames are reused by attempts and parses
+static void test_contexts() {
+  using dp = cp::parser<char, const char*>;
+  using lp = dp::with_context<cp::lazy_context<std::string>>;
+
+  std::vector<std::string> words;
+  bool touched = false;
+  const lp word = lp{alpha} % [&](const char* s, const char* e, auto w)->cp::result{
+    w->assign(s, e);
+    return [&words, w]{ words.push_back(*w); };
+  };
+  const lp probe = lp{digit} % [&](const char*, const char*, auto w){
+    touched = touched || w.created();
+    return cp::success;
+  };
+  const dp item = (word + lp{';'}) * cp::context_pool<std::string>{} | (probe * cp::context_pool<std::string>{});
+  const dp items = repeat(item + ~dp{','});
+
+  std::string in = "ab;,12,cd;,ef";
+  const char* pos = in.data();
+  auto r = items(pos, in.data() + in.size());
+  check(!touched, "context is created only when it is used");
+  check(r && pos == in.data() + in.size() - 2, "parse with pooled contexts");
+
+  // effects own their frames, other parses do not reuse them
+  std::string in2 = "xyz;";
+  const char* pos2 = in2.data();
+  auto r2 = items(pos2, in2.data() + in2.size());
+  r();
+  r2();
+  check(words == std::vector<std::string>{"ab", "cd", "xyz"}, "effects see their own contexts");
+
+  r = r2 = cp::fail;
+  auto frames = cp::context_pool<std::string>::allocated();
+  for (int i = 0; i < 100; ++i) {
+    pos = in.data();
+    items(pos, in.data() + in.size());
+  }
+  check(cp::context_pool<std::string>::allocated() == frames, "frames are reused across parses");
+
+  // effects destroyed by other thread give frames back to pool of thread, which parsed
+  std::size_t first_round = 0, last_round = 0;
+  std::thread worker([&]{
+    for (int round = 0; round < 5; ++round) {
+      std::vector<cp::result> rs;
+      for (int i = 0; i < 100; ++i) {
+        const char* p = in2.data();
+        rs.push_back(items(p, in2.data() + in2.size()));
+      }
+      std::thread([rs = std::move(rs)]() mutable { rs.clear(); }).join();
+      if (round == 0) first_round = cp::context_pool<std::string>::allocated();
+      last_round = cp::context_pool<std::string>::allocated();
+    }
+  });
+  worker.join();
+  check(first_round >= 100 && last_round == first_round, "frames released by other thread are reused");
+
+  // effects may outlive thread, which parsed them
+  std::vector<cp::result> kept;
+  std::thread([&]{
+    const char* p = in2.data();
+    kept.push_back(items(p, in2.data() + in2.size()));
+  }).join();
+  kept[0]();
+  kept.clear();
+  check(words.back() == "xyz", "effects outlive thread of their frames");
+}
+
 int main(int, char**)
 {
 
@@ -252,6 +1470,8 @@ int main(int, char**)
 
     std::string url = "http://[::1]:888/p1//p2///p3?arg1=213123&qwe=123123&asd;zxc&zzz=lkjh#fragment";
 
+    cp::input_guard guard{url}; // checks lifetime of string_views into url in debug builds
+
     auto start = url.begin();
 
     auto stop = url.end();
@@ -285,5 +1505,31 @@ int main(int, char**)
         for (auto f: ui.flags) cout << "  " << f << endl;
         cout << "fragment: " << ui.fragment << endl;
     }
-    return 0;
+
+    test_static();
+    test_effects();
+    test_memo();
+    test_memory_resource();
+    test_scan();
+    test_static_charset();
+    test_stream();
+    test_converters();
+    test_batch();
+    test_parallel_sep_by();
+    test_mapped_file();
+    test_ast();
+    test_cut();
+    test_longest();
+    test_keywords();
+    test_rules();
+    test_shared_rules();
+    test_diagnostics();
+    test_attributes();
+    test_async();
+    test_vm();
+    test_repeat();
+    test_utf8();
+    test_contexts();
+
+    return failed_checks == 0 ? 0 : 1;
 }   
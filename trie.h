@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Trie of literals for longest-match lookup.
+//
+// All literals are matched in one pass over input: common prefixes are read once,
+// lookup stops at first char which does not continue any literal.
+// Nodes are stored flat: edges of node are sorted labels and targets, first char
+// is looked up in 256-entry table.
+
+namespace comb_parser {
+
+template<typename Char = char>
+class literal_trie {
+public:
+  using string_type = std::basic_string<Char>;
+
+  literal_trie() : literal_trie(std::vector<string_type>{}) { }
+
+  // index of literal is its position in 'literals', for duplicates first one is used
+  explicit literal_trie(const std::vector<string_type>& literals) : literals(literals) {
+    // build pointer-based tree, then flatten it in breadth-first order
+    struct tmp_node {
+      std::map<Char, std::unique_ptr<tmp_node>> next;
+      int value = -1;
+    };
+    tmp_node root;
+    for (std::size_t i = 0; i < literals.size(); ++i) {
+      auto n = &root;
+      for (auto c: literals[i]) {
+        auto& child = n->next[c];
+        if (!child) child = std::make_unique<tmp_node>();
+        n = child.get();
+      }
+      if (n->value < 0) n->value = static_cast<int>(i);
+    }
+
+    std::vector<const tmp_node*> order{&root};
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      const tmp_node* t = order[i];
+      node n;
+      n.value = t->value;
+      n.edges = static_cast<uint32_t>(labels.size());
+      n.count = static_cast<uint32_t>(t->next.size());
+      for (auto& [c, child]: t->next) {
+        labels.push_back(c);
+        targets.push_back(static_cast<uint32_t>(order.size()));
+        order.push_back(child.get());
+      }
+      nodes.push_back(n);
+    }
+
+    root_next.fill(0);
+    for (uint32_t e = 0; e < nodes[0].count; ++e) {
+      auto c = static_cast<std::make_unsigned_t<Char>>(labels[e]);
+      if (c < 256) root_next[c] = targets[e];
+    }
+  }
+
+  // longest literal at pos: returns its index and moves pos after it, or returns -1
+  template<typename Iter>
+  int match(Iter& pos, Iter end) const {
+    int found = nodes[0].value;
+    auto found_pos = pos;
+    auto p = pos;
+    uint32_t n = 0;
+    if (p != end) {
+      auto c = static_cast<std::make_unsigned_t<Char>>(*p);
+      n = c < 256 ? root_next[c] : step(0, *p);
+      if (n) {
+        ++p;
+        for (;;) {
+          if (nodes[n].value >= 0) { found = nodes[n].value; found_pos = p; }
+          if (p == end || nodes[n].count == 0) break;
+          n = step(n, *p);
+          if (!n) break;
+          ++p;
+        }
+      }
+    }
+    if (found >= 0) pos = found_pos;
+    return found;
+  }
+
+  std::size_t size() const { return literals.size(); }
+
+  // bitmap of first chars of literals
+  std::array<uint64_t, 4> first_chars() const {
+    std::array<uint64_t, 4> bits{0, 0, 0, 0};
+    for (int c = 0; c < 256; ++c) if (root_next[c]) bits[c >> 6] |= uint64_t{1} << (c & 0x3F);
+    return bits;
+  }
+
+  const string_type& literal(std::size_t idx) const { return literals[idx]; }
+
+private:
+  struct node {
+    uint32_t edges = 0; // first edge in labels/targets
+    uint32_t count = 0; // number of edges
+    int value = -1;     // index of literal, which ends in this node
+  };
+
+  std::vector<string_type> literals;
+  std::vector<node> nodes;
+  std::vector<Char> labels;
+  std::vector<uint32_t> targets;  // 0 is root, so it means 'no edge' in lookups
+  std::array<uint32_t, 256> root_next;
+
+  uint32_t step(uint32_t n, Char c) const {
+    auto first = labels.begin() + nodes[n].edges;
+    auto last = first + nodes[n].count;
+    if (nodes[n].count <= 8) {
+      for (auto it = first; it != last; ++it) if (*it == c) return targets[it - labels.begin()];
+      return 0;
+    }
+    auto it = std::lower_bound(first, last, c);
+    return it != last && *it == c ? targets[it - labels.begin()] : 0;
+  }
+};
+
+} // namespace comb_parser
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "charset.h"
+#include "scan.h"
+
+// UTF-8 input: code-point charsets, decoding iterators and validation.
+//
+// utf8::iterator<Bytes> reads UTF-8 bytes as char32_t code points, so grammar over it is
+// parser<char32_t, utf8::iterator<const char*>>: chars and literals are code points (U'é', U"straße"),
+// utf8::charset is set of code points, it is matched as span like byte charset:
+//
+//   using up = cp::parser<char32_t, utf8::iterator<const char*>>;
+//   const up label = up{utf8::charset::range(U'a', U'z') + utf8::charset::range(0x430, 0x44F)};
+//   auto pos = utf8::begin(input);
+//   label(pos, utf8::end(input));
+//
+// Charset keeps ASCII members in bitmap and other code points as sorted ranges. Over contiguous bytes
+// span skips runs of ASCII members with SIMD kernels of scan.h and decodes only non-ASCII code points.
+// Invalid sequences are read as U+FFFD of one byte; utf8::validate checks input beforehand, ASCII blocks
+// are tested 16/32 bytes at a time, and tells whether input is ASCII only, i.e. byte grammar may be used.
+
+namespace comb_parser::utf8 {
+
+constexpr char32_t replacement = 0xFFFD;
+constexpr char32_t max_code_point = 0x10FFFF;
+
+namespace detail {
+
+// decodes code point at p, returns length of its sequence or 0 if sequence is invalid
+template<typename Bytes>
+int decode(Bytes p, Bytes e, char32_t& cp) {
+  auto b = static_cast<uint8_t>(*p);
+  if (b < 0x80) { cp = b; return 1; }
+  int len;
+  char32_t min;
+  if ((b & 0xE0) == 0xC0) { len = 2; cp = b & 0x1F; min = 0x80; }
+  else if ((b & 0xF0) == 0xE0) { len = 3; cp = b & 0x0F; min = 0x800; }
+  else if ((b & 0xF8) == 0xF0) { len = 4; cp = b & 0x07; min = 0x10000; }
+  else return 0;
+  for (int i = 1; i < len; ++i) {
+    if (++p == e) return 0;
+    auto c = static_cast<uint8_t>(*p);
+    if ((c & 0xC0) != 0x80) return 0;
+    cp = (cp << 6) | (c & 0x3F);
+  }
+  if (cp < min || cp > max_code_point || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+  return len;
+}
+
+//==========
+// ASCII runs
+
+inline const uint8_t* skip_ascii_scalar(const uint8_t* p, const uint8_t* e) {
+  for (; p != e && *p < 0x80; ++p) { }
+  return p;
+}
+
+#ifdef COMB_PARSER_SCAN_X86
+
+__attribute__((target("sse2")))
+inline const uint8_t* skip_ascii_sse2(const uint8_t* p, const uint8_t* e) {
+  for (; e - p >= 16; p += 16) {
+    unsigned mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+  return skip_ascii_scalar(p, e);
+}
+
+__attribute__((target("avx2")))
+inline const uint8_t* skip_ascii_avx2(const uint8_t* p, const uint8_t* e) {
+  for (; e - p >= 32; p += 32) {
+    unsigned mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+  return skip_ascii_sse2(p, e);
+}
+
+#endif
+
+using ascii_kernel = const uint8_t* (*)(const uint8_t*, const uint8_t*);
+
+inline ascii_kernel select_ascii_kernel() {
+#ifdef COMB_PARSER_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return skip_ascii_avx2;
+  if (__builtin_cpu_supports("sse2")) return skip_ascii_sse2;
+#endif
+  return skip_ascii_scalar;
+}
+
+} // namespace detail
+
+// first byte in [p, e), which is not ASCII
+inline const uint8_t* skip_ascii(const uint8_t* p, const uint8_t* e) {
+  static const detail::ascii_kernel k = detail::select_ascii_kernel();
+  if (e - p < 16) return detail::skip_ascii_scalar(p, e);
+  return k(p, e);
+}
+
+//==========
+// Validation
+
+struct validation {
+  bool valid;
+  bool ascii;         // input is ASCII only, byte parsers may be used for it
+  const char* error;  // first byte of invalid sequence, end of input if input is valid
+};
+
+inline validation validate(const char* begin, const char* end) {
+  auto p = reinterpret_cast<const uint8_t*>(begin);
+  auto e = reinterpret_cast<const uint8_t*>(end);
+  bool ascii = true;
+  for (;;) {
+    p = skip_ascii(p, e);
+    if (p == e) return {true, ascii, end};
+    ascii = false;
+    char32_t cp;
+    int len = detail::decode(p, e, cp);
+    if (!len) return {false, false, reinterpret_cast<const char*>(p)};
+    p += len;
+  }
+}
+
+inline validation validate(const std::string& s) { return validate(s.data(), s.data() + s.size()); }
+
+//==========
+// Decoding iterator
+
+template<typename Bytes = const char*>
+class iterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = char32_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const char32_t*;
+  using reference = const char32_t&;
+
+  iterator() = default;
+  // e is end of bytes, sequences are not read past it
+  iterator(Bytes p, Bytes e) : p(p), e(e) { decode_here(); }
+
+  reference operator*() const { return cp; }
+
+  iterator& operator++() { std::advance(p, len); decode_here(); return *this; }
+  iterator operator++(int) { auto it = *this; ++*this; return it; }
+
+  friend bool operator==(const iterator& a, const iterator& b) { return a.p == b.p; }
+  friend bool operator!=(const iterator& a, const iterator& b) { return a.p != b.p; }
+
+  // position in bytes
+  Bytes base() const { return p; }
+  Bytes bytes_end() const { return e; }
+
+private:
+  Bytes p{};
+  Bytes e{};
+  char32_t cp = 0;
+  int len = 0;
+
+  void decode_here() {
+    if (p == e) { len = 0; return; }
+    len = detail::decode(p, e, cp);
+    if (!len) { cp = replacement; len = 1; }
+  }
+};
+
+template<typename C>
+iterator<const char*> begin(const C& c) { return {c.data(), c.data() + c.size()}; }
+
+template<typename C>
+iterator<const char*> end(const C& c) { return {c.data() + c.size(), c.data() + c.size()}; }
+
+//==========
+// Code-point charset
+
+struct range {
+  char32_t from;
+  char32_t to;
+};
+
+class charset {
+public:
+  charset() : ascii_table(comb_parser::charset::charset{}) { }
+
+  charset(std::initializer_list<utf8::range> rs) : charset(std::vector<utf8::range>(rs)) { }
+
+  // code points of string
+  charset(const char32_t* s) : charset(points(s)) { }
+
+  // bytes of byte charset are code points U+0000..U+00FF
+  charset(const comb_parser::charset::charset& bytes) : charset(from_bytes(bytes)) { }
+
+  static charset range(char32_t from, char32_t to) { return charset{{from, to}}; }
+
+  bool contains(char32_t c) const {
+    if (c < 0x80) return (ascii[c >> 6] & (uint64_t{1} << (c & 0x3F))) != 0;
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), c, [](char32_t v, const utf8::range& r){ return v < r.from; });
+    return it != ranges.begin() && c <= (it - 1)->to;
+  }
+
+  bool operator()(char32_t c) const { return contains(c); }
+
+  charset operator+(const charset& c) const {
+    auto rs = ranges;
+    rs.insert(rs.end(), c.ranges.begin(), c.ranges.end());
+    return charset{std::move(rs)};
+  }
+
+  charset operator!() const {
+    std::vector<utf8::range> rs;
+    char32_t next = 0;
+    for (auto& r: ranges) {
+      if (r.from > next) rs.push_back({next, r.from - 1});
+      next = r.to + 1;
+    }
+    if (next <= max_code_point) rs.push_back({next, max_code_point});
+    return charset{std::move(rs)};
+  }
+
+  charset operator-(const charset& c) const { return !(!*this + c); }
+
+  const std::vector<utf8::range>& code_ranges() const { return ranges; }
+
+  // ASCII members as byte charset bitmap
+  std::array<uint64_t, 4> ascii_bits() const { return {ascii[0], ascii[1], 0, 0}; }
+
+  // end of span of members from pos
+  template<typename Iter>
+  Iter span(Iter pos, Iter end) const {
+    if constexpr (is_utf8_over_bytes<Iter>::value) {
+      // runs of ASCII members are scanned with SIMD, other code points are decoded
+      if (pos == end) return pos;
+      const auto start = reinterpret_cast<const uint8_t*>(&*pos.base());
+      const auto e = start + (end.base() - pos.base());
+      auto p = start;
+      for (;;) {
+        p = scan::skip(ascii_table, p, e);
+        if (p == e || *p < 0x80) break;
+        char32_t cp;
+        int len = detail::decode(p, e, cp);
+        if (!len || !contains(cp)) break;
+        p += len;
+      }
+      return Iter{pos.base() + (p - start), pos.bytes_end()};
+    } else {
+      for (; pos != end && contains(static_cast<char32_t>(*pos)); ++pos) { }
+      return pos;
+    }
+  }
+
+private:
+  std::vector<utf8::range> ranges; // sorted, disjoint, not adjacent
+  uint64_t ascii[2] = {0, 0};
+  scan::table ascii_table;
+
+  template<typename Iter>
+  struct is_utf8_over_bytes : std::false_type { };
+
+  template<typename Bytes>
+  struct is_utf8_over_bytes<iterator<Bytes>> : scan::is_contiguous_bytes<Bytes> { };
+
+  explicit charset(std::vector<utf8::range> rs) : ascii_table(comb_parser::charset::charset{}) {
+    for (auto& r: rs) r.to = std::min(r.to, max_code_point);
+    rs.erase(std::remove_if(rs.begin(), rs.end(), [](const utf8::range& r){ return r.from > r.to; }), rs.end());
+    std::sort(rs.begin(), rs.end(), [](const utf8::range& a, const utf8::range& b){ return a.from < b.from; });
+    for (auto& r: rs) {
+      if (!ranges.empty() && r.from <= ranges.back().to + 1) ranges.back().to = std::max(ranges.back().to, r.to);
+      else ranges.push_back(r);
+    }
+    comb_parser::charset::charset bytes;
+    for (char32_t c = 0; c < 0x80; ++c) {
+      if (!contains_range(c)) continue;
+      ascii[c >> 6] |= uint64_t{1} << (c & 0x3F);
+      bytes = bytes + std::string(1, static_cast<char>(c));
+    }
+    ascii_table = scan::table{bytes};
+  }
+
+  bool contains_range(char32_t c) const {
+    for (auto& r: ranges) if (c >= r.from && c <= r.to) return true;
+    return false;
+  }
+
+  static std::vector<utf8::range> points(const char32_t* s) {
+    std::vector<utf8::range> rs;
+    for (; *s; ++s) rs.push_back({*s, *s});
+    return rs;
+  }
+
+  static std::vector<utf8::range> from_bytes(const comb_parser::charset::charset& bytes) {
+    std::vector<utf8::range> rs;
+    for (char32_t c = 0; c < 256; ++c) if (bytes(static_cast<uint8_t>(c))) rs.push_back({c, c});
+    return rs;
+  }
+};
+
+} // namespace comb_parser::utf8
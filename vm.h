@@ -0,0 +1,378 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "comb_parser.h"
+#include "ast.h"
+#include "scan.h"
+
+// Bytecode backend for grammar trees (ast.h).
+//
+// Grammars assembled at runtime are compiled into flat array of instructions, which is run
+// by one dispatch loop with explicit backtrack stack (in the style of LPeg), so there is
+// no recursion of std::function calls and code of grammar is contiguous in memory:
+//
+//   using g = ast::expr<char, Iter, uri_info*>;
+//   const g grammar = ...;                  // e.g. built from config
+//   const vm::program prog{grammar.optimize()};
+//   auto r = prog(pos, end, &ui);           // or prog.as_parser()
+//
+// Chars, literals, charsets, end, sequences, choices (with FIRST set tests, if tree is optimized),
+// optionals, repeats, skips, check-nexts and negations become instructions. Actions and opaque parsers
+// are referenced by index; process (a % b) and longest(...) nodes, and repeats with large bounds,
+// are compiled into parsers by expr and called as opaque ones.
+// Effects of actions and opaque parsers are collected in order and dropped on backtracking.
+// Failures are reported to active diagnostics (diagnostics.h) as by leaf parsers.
+// Cut set by '>' inside of opaque parser is honoured as by combinators: choices, optionals and
+// repeats are not retried, negation stops it.
+
+namespace comb_parser::vm {
+
+enum class op : uint8_t {
+  chr,            // arg: char
+  literal,        // arg: index of literal
+  set,            // arg: index of charset, one or more chars
+  end,            // end of input
+  test_set,       // arg: index of charset; jump to label, if lookahead is not in set
+  choice,         // push backtrack entry to label; arg 1: entry of negation, it stops cut
+  commit,         // pop backtrack entry, jump to label
+  partial_commit, // update backtrack entry to current state and jump to label, pop it if nothing consumed
+  back_commit,    // pop backtrack entry, restore its position and effects, jump to label
+  fail,           // backtrack to the top entry, fail program if there is none
+  fail_twice,     // pop backtrack entry and fail
+  jump,           // jump to label
+  call,           // arg: index of opaque parser
+  mark,           // save position and number of effects
+  drop,           // drop effects made after the mark
+  action,         // arg: index of action, it is called on chunk from the mark to position
+  ret             // success
+};
+
+struct instruction {
+  op code;
+  uint32_t arg = 0;
+  uint32_t label = 0;
+};
+
+template<typename Char = char, typename Iter = const char*, typename ...Args>
+class program {
+public:
+  using expr_type = ast::expr<Char, Iter, Args...>;
+  using parser_type = parser<Char, Iter, Args...>;
+
+  explicit program(const expr_type& e) {
+    emit(e.ptr());
+    code.push_back({op::ret});
+  }
+
+  result operator()(Iter& pos, Iter end, Args...args) const {
+    struct entry {
+      uint32_t label;
+      Iter pos;
+      std::size_t effects;
+      std::size_t marks;
+      bool negation;
+    };
+    struct mark_entry {
+      Iter pos;
+      std::size_t effects;
+    };
+    std::vector<entry> stack;
+    std::vector<mark_entry> marks;
+    std::vector<result> effects;
+    const auto start = pos;
+    auto p = pos;
+    uint32_t pc = 0;
+
+    for (;;) {
+      const auto& i = code[pc];
+      switch (i.code) {
+        case op::chr:
+          if (p != end && *p == static_cast<Char>(i.arg)) { ++p; ++pc; continue; }
+          detail::expected_char(p, static_cast<Char>(i.arg));
+          break;
+        case op::literal:
+          if (scan::match_literal(literals[i.arg], p, end)) { ++pc; continue; }
+          detail::expected_literal(p, end, literals[i.arg]);
+          break;
+        case op::set: {
+          auto s = p;
+          if constexpr (sizeof(Char) == 1) {
+            p = scan::skip(sets[i.arg], p, end);
+          } else {
+            for (; p != end && in_table(sets[i.arg], *p); ++p) { }
+          }
+          if (p != s) { ++pc; continue; }
+          detail::expected_set(p, sets[i.arg].bits());
+          break;
+        }
+        case op::end:
+          if (p == end) { ++pc; continue; }
+          detail::expected_end(p);
+          break;
+        case op::test_set:
+          // wide lookahead is not in tables, alternative is tried as in tree
+          if (p != end && (wide(*p) || in_table(sets[i.arg], *p))) { ++pc; continue; }
+          detail::expected_set(p, sets[i.arg].bits()); // alternative is skipped, it expected its FIRST chars
+          pc = i.label;
+          continue;
+        case op::choice:
+          stack.push_back({i.label, p, effects.size(), marks.size(), i.arg == 1});
+          ++pc;
+          continue;
+        case op::commit:
+          stack.pop_back();
+          pc = i.label;
+          continue;
+        case op::partial_commit: {
+          auto& e = stack.back();
+          if (e.pos == p) { stack.pop_back(); ++pc; continue; } // nothing consumed, it will repeat forever
+          e.pos = p;
+          e.effects = effects.size();
+          e.marks = marks.size();
+          pc = i.label;
+          continue;
+        }
+        case op::back_commit: {
+          auto e = stack.back();
+          stack.pop_back();
+          p = e.pos;
+          effects.resize(e.effects);
+          marks.resize(e.marks);
+          pc = i.label;
+          continue;
+        }
+        case op::fail:
+          break;
+        case op::fail_twice:
+          stack.pop_back();
+          break;
+        case op::jump:
+          pc = i.label;
+          continue;
+        case op::call: {
+          auto r = refs[i.arg](p, end, args...);
+          if (!r) break;
+          add_effect(effects, std::move(r));
+          ++pc;
+          continue;
+        }
+        case op::mark:
+          marks.push_back({p, effects.size()});
+          ++pc;
+          continue;
+        case op::drop:
+          effects.resize(marks.back().effects);
+          marks.pop_back();
+          ++pc;
+          continue;
+        case op::action: {
+          auto from = marks.back().pos;
+          marks.pop_back();
+          auto r = actions[i.arg](from, p, args...);
+          if (!r) break;
+          add_effect(effects, std::move(r));
+          ++pc;
+          continue;
+        }
+        case op::ret:
+          pos = p;
+          if (effects.empty()) return success;
+          return [effects = std::move(effects)]{ for (auto& r: effects) r(); };
+      }
+
+      // failure: backtrack; cut made by '>' inside of opaque parser commits choices, optionals
+      // and repeats as in combinators, only negation stops it
+      if (detail::cuts().cut) {
+        while (!stack.empty() && !stack.back().negation) stack.pop_back();
+        if (!stack.empty()) detail::cuts().cut = false;
+      }
+      if (stack.empty()) {
+        detail::backtracked(start, p);
+        pos = start;
+        return fail;
+      }
+      auto e = stack.back();
+      stack.pop_back();
+      detail::backtracked(e.pos, p);
+      p = e.pos;
+      effects.resize(e.effects);
+      marks.resize(e.marks);
+      pc = e.label;
+    }
+  }
+
+  // program as ordinary parser, program is shared
+  parser_type as_parser() const {
+    return parser_type{[prog = std::make_shared<const program>(*this)](Iter& pos, Iter end, Args...args){
+      return (*prog)(pos, end, args...);
+    }};
+  }
+
+  std::size_t size() const { return code.size(); }
+  const std::vector<instruction>& instructions() const { return code; }
+
+private:
+  using node_ptr = typename expr_type::node_ptr;
+  using kind = ast::kind;
+
+  // unrolled repeats are limited, larger ones are called as parsers
+  static constexpr int max_unroll = 16;
+
+  std::vector<instruction> code;
+  std::vector<std::basic_string<Char>> literals;
+  std::vector<scan::table> sets;
+  std::vector<typename parser_type::parserFn> actions;
+  std::vector<parser_type> refs;
+
+  static bool wide(Char c) { return static_cast<std::make_unsigned_t<Char>>(c) >= 256; }
+
+  static bool in_table(const scan::table& t, Char c) {
+    auto u = static_cast<std::make_unsigned_t<Char>>(c);
+    return u < 256 && t.contains(static_cast<uint8_t>(u));
+  }
+
+  static void add_effect(std::vector<result>& effects, result r) {
+    if (r.target_type() != success.target_type()) effects.push_back(std::move(r));
+  }
+
+  //=====================
+  // Compilation
+
+  uint32_t here() const { return static_cast<uint32_t>(code.size()); }
+
+  uint32_t emit(op code_op, uint32_t arg = 0, uint32_t label = 0) {
+    code.push_back({code_op, arg, label});
+    return here() - 1;
+  }
+
+  uint32_t add_set(const charset::charset& cs) {
+    sets.emplace_back(cs);
+    return static_cast<uint32_t>(sets.size() - 1);
+  }
+
+  void emit_ref(const parser_type& p) {
+    refs.push_back(p);
+    emit(op::call, static_cast<uint32_t>(refs.size() - 1));
+  }
+
+  void emit(const node_ptr& n) {
+    switch (n->kind) {
+      case kind::end: emit(op::end); return;
+      case kind::chr: emit(op::chr, static_cast<uint32_t>(static_cast<std::make_unsigned_t<Char>>(n->text[0]))); return;
+      case kind::literal:
+        literals.push_back(n->text);
+        emit(op::literal, static_cast<uint32_t>(literals.size() - 1));
+        return;
+      case kind::set: emit(op::set, add_set(n->set)); return;
+      case kind::sequence:
+        for (auto& c: n->children) emit(c);
+        return;
+      case kind::choice: emit_choice(*n); return;
+      case kind::optional: {
+        auto ch = emit(op::choice);
+        emit(n->children[0]);
+        auto cm = emit(op::commit);
+        code[ch].label = code[cm].label = here();
+        return;
+      }
+      case kind::repeat: emit_repeat(n); return;
+      case kind::skip:
+        // effects of all but last child are dropped
+        for (std::size_t i = 0; i + 1 < n->children.size(); ++i) {
+          emit(op::mark);
+          emit(n->children[i]);
+          emit(op::drop);
+        }
+        emit(n->children.back());
+        return;
+      case kind::check_next:
+        // first child is parsed, the rest should follow it
+        emit(n->children[0]);
+        for (std::size_t i = 1; i < n->children.size(); ++i) {
+          auto ch = emit(op::choice);
+          emit(n->children[i]);
+          auto bc = emit(op::back_commit);
+          code[ch].label = emit(op::fail);
+          code[bc].label = here();
+        }
+        return;
+      case kind::negation: {
+        auto ch = emit(op::choice, 1);
+        emit(n->children[0]);
+        emit(op::fail_twice);
+        code[ch].label = here();
+        return;
+      }
+      case kind::action:
+        emit(op::mark);
+        emit(n->children[0]);
+        actions.push_back(n->fn);
+        emit(op::action, static_cast<uint32_t>(actions.size() - 1));
+        return;
+      case kind::process:
+      case kind::longest:
+        emit_ref(expr_type{n}.compile());
+        return;
+      case kind::ref:
+        emit_ref(n->ref);
+        return;
+    }
+  }
+
+  // alternatives, which cannot start with lookahead byte, are skipped without backtracking
+  void emit_choice(const typename expr_type::node& n) {
+    std::vector<uint32_t> commits;
+    for (std::size_t i = 0; i < n.children.size(); ++i) {
+      bool last = i + 1 == n.children.size();
+      bool test = i < n.alternatives.size() && !n.alternatives[i].nullable;
+      uint32_t ts = 0, ch = 0;
+      if (test) ts = emit(op::test_set, add_set(n.alternatives[i].first));
+      if (!last) ch = emit(op::choice);
+      emit(n.children[i]);
+      if (!last) commits.push_back(emit(op::commit));
+      if (last && test) {
+        commits.push_back(emit(op::jump));
+        code[ts].label = emit(op::fail);
+      } else {
+        if (test) code[ts].label = here();
+        if (!last) code[ch].label = here();
+      }
+    }
+    for (auto c: commits) code[c].label = here();
+  }
+
+  void emit_repeat(const node_ptr& n) {
+    auto& body = n->children[0];
+    int optional_times = n->to_times == -1 ? 1 : n->to_times - n->from_times;
+    if (n->from_times + optional_times > max_unroll || optional_times < 0) {
+      emit_ref(expr_type{n}.compile());
+      return;
+    }
+    for (int k = 0; k < n->from_times; ++k) emit(body);
+    if (n->to_times == -1) {
+      auto ch = emit(op::choice);
+      emit(body);
+      emit(op::partial_commit, 0, ch + 1);
+      code[ch].label = here();
+      return;
+    }
+    std::vector<uint32_t> choices;
+    for (int k = 0; k < optional_times; ++k) {
+      choices.push_back(emit(op::choice));
+      emit(body);
+      emit(op::commit, 0, here() + 1);
+    }
+    for (auto c: choices) code[c].label = here();
+  }
+};
+
+template<typename Char, typename Iter, typename ...Args>
+program(const ast::expr<Char, Iter, Args...>&) -> program<Char, Iter, Args...>;
+
+} // namespace comb_parser::vm